@@ -0,0 +1,348 @@
+// winsock2 must be included before windows.h (pulled by winpp)
+#include <winsock2.h>
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <regex>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cstdint>
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <winpp/files.hpp>
+#include "file-infos.hpp"
+#include "database.hpp"
+#include "sha256.hpp"
+#include "json-writer.hpp"
+#include "ordered-results.hpp"
+#include "radix-sort.hpp"
+#include "alloc-tracking.hpp"
+
+// microbenchmarks of the hot components of the scan
+// - fixtures are generated (same content at each run) in the temporary directory
+// - the baselines are the implementations replaced by the optimizations
+// - usage: mark-files-bench.exe --benchmark_filter=json --benchmark_repetitions=5
+// - the peak of the heap of each benchmark is measured by the allocation tracking builds
+
+/*============================================
+| Fixtures
+==============================================*/
+// name of the file i of a generated tree: 100 files per directory
+std::string fixture_name(const std::size_t i)
+{
+  return fmt::format("c:\\data\\projects\\dir{:05}\\sub\\file{:08}.bin", i / 100, i);
+}
+
+// infos of the file i of a generated tree
+file_infos fixture_infos(const std::size_t i)
+{
+  sha256 hash;
+  hash.update(&i, sizeof(i));
+  return { hash.hex(), 1600000000 + i, 1600000000 + 2 * i, 4096 + i };
+}
+
+// completion order of count files hashed by threads: shuffled inside each block of the reorder
+// window (the threads can't store further than the window ahead of the consumer)
+std::vector<std::size_t> fixture_order(const std::size_t count)
+{
+  std::vector<std::size_t> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::mt19937_64 random(1);
+  for (std::size_t begin = 0; begin < count; begin += g_reorder_window)
+    std::shuffle(order.begin() + begin, order.begin() + std::min(count, begin + g_reorder_window), random);
+  return order;
+}
+
+// path of a fixture file of the temporary directory
+std::filesystem::path fixture_path(const std::string& name)
+{
+  return std::filesystem::temp_directory_path() / ("mark-files-bench-" + name);
+}
+
+// database (json file) of count generated files - written once per run
+const std::filesystem::path& fixture_database(const std::size_t count)
+{
+  static std::map<std::size_t, std::filesystem::path> databases;
+  auto it = databases.find(count);
+  if (it == databases.end())
+  {
+    const std::filesystem::path& path = fixture_path(fmt::format("{}.json", count));
+    json_writer writer(path, fixture_name(count).size() + 2);
+    for (std::size_t i = 0; i < count; ++i)
+      writer.write(fixture_name(i), fixture_infos(i));
+    writer.close();
+    it = databases.emplace(count, path).first;
+  }
+  return it->second;
+}
+
+// file of size bytes of pseudo-random content - written once per run
+const std::filesystem::path& fixture_file(const std::size_t size)
+{
+  static std::map<std::size_t, std::filesystem::path> files;
+  auto it = files.find(size);
+  if (it == files.end())
+  {
+    const std::filesystem::path& path = fixture_path(fmt::format("{}.bin", size));
+    std::ofstream file(path, std::ios::binary);
+    std::uint64_t x = size;
+    for (std::size_t i = 0; i < size; i += sizeof(x))
+    {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      file.write(reinterpret_cast<const char*>(&x), static_cast<std::streamsize>(std::min(sizeof(x), size - i)));
+    }
+    it = files.emplace(size, path).first;
+  }
+  return it->second;
+}
+
+/*============================================
+| SHA256
+==============================================*/
+// hash of a buffer in memory by the sha256 of the program (archives, copies, resumable)
+void BM_sha256_update(benchmark::State& state)
+{
+  const std::vector<char> buffer(static_cast<std::size_t>(state.range(0)), 'x');
+  for (auto _ : state)
+  {
+    sha256 hash;
+    hash.update(buffer.data(), buffer.size());
+    benchmark::DoNotOptimize(hash.final());
+  }
+  state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_sha256_update)->RangeMultiplier(16)->Range(64, 16 << 20);
+
+// hash of a file by the sha256 of winpp (files of the scan) - in the system cache
+void BM_files_get_hash(benchmark::State& state)
+{
+  const std::filesystem::path& path = fixture_file(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(files::get_hash(path));
+  state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_files_get_hash)->RangeMultiplier(16)->Range(4 << 10, 16 << 20);
+
+/*============================================
+| JSON codec
+==============================================*/
+// baseline: escape of the name by regex and allocation of the line
+void BM_json_line_regex(benchmark::State& state)
+{
+  const std::string& name = fixture_name(12345);
+  const file_infos& infos = fixture_infos(12345);
+  const std::string line_fmt = R"("name": "{:<)" + std::to_string(name.size() + 8) +
+                               R"(}, "sha": "{}", "ctime": {}, "mtime": {}, "size": {})";
+  for (auto _ : state)
+  {
+    const std::string& line = "    { " + fmt::format(line_fmt,
+      std::regex_replace(name, std::regex("\\\\"), "\\\\") + "\"",
+      infos.sha,
+      infos.ctime,
+      infos.mtime,
+      infos.size) + " }";
+    benchmark::DoNotOptimize(line.data());
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_json_line_regex);
+
+// line of the json writer (reused buffers)
+void BM_json_line_format(benchmark::State& state)
+{
+  const std::string& name = fixture_name(12345);
+  const file_infos& infos = fixture_infos(12345);
+  json_writer writer(fixture_path("line.json"), name.size() + 8);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(writer.format(name, infos).data());
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_json_line_format);
+
+// database written line by line (file of the temporary directory)
+void BM_json_write(benchmark::State& state)
+{
+  const std::size_t count = static_cast<std::size_t>(state.range(0));
+  std::vector<db_record> records;
+  for (std::size_t i = 0; i < count; ++i)
+    records.emplace_back(fixture_name(i), fixture_infos(i));
+  for (auto _ : state)
+  {
+    json_writer writer(fixture_path("write.json"), fixture_name(count).size() + 2);
+    for (const auto& [name, infos] : records)
+      writer.write(name, infos);
+    writer.close();
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_json_write)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+/*============================================
+| Database loaders
+==============================================*/
+// streaming read of a database (sax): one record at a time
+void BM_read_database(benchmark::State& state)
+{
+  const std::size_t count = static_cast<std::size_t>(state.range(0));
+  const std::filesystem::path& path = fixture_database(count);
+  for (auto _ : state)
+  {
+    std::size_t n = 0;
+    read_database(path, [&](const db_record&) { ++n; });
+    benchmark::DoNotOptimize(n);
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+  state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * std::filesystem::file_size(path)));
+}
+BENCHMARK(BM_read_database)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// load of all the records of a database
+void BM_load_database(benchmark::State& state)
+{
+  const std::size_t count = static_cast<std::size_t>(state.range(0));
+  const std::filesystem::path& path = fixture_database(count);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(load_database(path).size());
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_load_database)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+/*============================================
+| Result containers
+==============================================*/
+// baseline: results sorted by a map of the names
+void BM_results_std_map(benchmark::State& state)
+{
+  const std::size_t count = static_cast<std::size_t>(state.range(0));
+  std::vector<db_record> records;
+  for (std::size_t i = 0; i < count; ++i)
+    records.emplace_back(fixture_name(i), fixture_infos(i));
+  const std::vector<std::size_t>& order = fixture_order(count);
+  for (auto _ : state)
+  {
+    std::map<std::string, file_infos> results;
+    for (const std::size_t i : order)
+      results.emplace(records[i].first, records[i].second);
+    std::uint64_t total = 0;
+    for (const auto& [name, infos] : results)
+      total += infos.size;
+    benchmark::DoNotOptimize(total);
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_results_std_map)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// results stored in the slot of their enumeration index (reorder window)
+// - stored in the completion order of the threads, consumed once each block is complete
+void BM_results_ordered(benchmark::State& state)
+{
+  const std::size_t count = static_cast<std::size_t>(state.range(0));
+  std::vector<db_record> records;
+  for (std::size_t i = 0; i < count; ++i)
+    records.emplace_back(fixture_name(i), fixture_infos(i));
+  const std::vector<std::size_t>& order = fixture_order(count);
+  for (auto _ : state)
+  {
+    ordered_results results(count, g_reorder_window);
+    std::uint64_t total = 0;
+    for (std::size_t begin = 0; begin < count; begin += g_reorder_window)
+    {
+      const std::size_t end = std::min(count, begin + g_reorder_window);
+      for (std::size_t j = begin; j < end; ++j)
+      {
+        file_infos infos = records[order[j]].second;
+        results.store(order[j], std::move(infos));
+      }
+      for (std::size_t j = begin; j < end; ++j)
+      {
+        total += results.front().size;
+        results.pop();
+      }
+    }
+    benchmark::DoNotOptimize(total);
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_results_ordered)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// baseline: sort of the names by std::sort
+void BM_sort_std(benchmark::State& state)
+{
+  const std::size_t count = static_cast<std::size_t>(state.range(0));
+  std::vector<std::string> names;
+  for (std::size_t i = 0; i < count; ++i)
+    names.push_back(fixture_name((i * 7919) % count));
+  for (auto _ : state)
+  {
+    std::vector<std::uint32_t> idx(count);
+    for (std::size_t i = 0; i < count; ++i)
+      idx[i] = static_cast<std::uint32_t>(i);
+    std::sort(idx.begin(), idx.end(), [&](const std::uint32_t a, const std::uint32_t b) {
+      return names[a] < names[b];
+      });
+    benchmark::DoNotOptimize(idx.data());
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_sort_std)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+// sort of the names by the parallel radix sort (database index)
+void BM_sort_radix(benchmark::State& state)
+{
+  const std::size_t count = static_cast<std::size_t>(state.range(0));
+  std::vector<std::string> names;
+  for (std::size_t i = 0; i < count; ++i)
+    names.push_back(fixture_name((i * 7919) % count));
+  for (auto _ : state)
+  {
+    const std::vector<std::uint32_t>& idx = radix_sort::order(count, [&](const std::uint32_t i) {
+      return std::string_view(names[i]);
+      });
+    benchmark::DoNotOptimize(idx.data());
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_sort_radix)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+#ifdef MARK_FILES_ALLOC_TRACKING
+// heap of one run of a benchmark (max_bytes_used of the results)
+class heap_manager : public benchmark::MemoryManager {
+public:
+  void Start() override
+  {
+    m_start = alloc_tracking::process_stats();
+    m_live = alloc_tracking::live();
+    alloc_tracking::reset_peak();
+  }
+
+  void Stop(Result& result) override
+  {
+    const alloc_tracking::stats& s = alloc_tracking::process_stats();
+    result.num_allocs = static_cast<std::int64_t>(s.allocations - m_start.allocations);
+    result.total_allocated_bytes = static_cast<std::int64_t>(s.bytes - m_start.bytes);
+    result.max_bytes_used = static_cast<std::int64_t>(alloc_tracking::peak() - std::min(alloc_tracking::peak(), m_live));
+    result.net_heap_growth = static_cast<std::int64_t>(alloc_tracking::live()) - static_cast<std::int64_t>(m_live);
+  }
+
+private:
+  alloc_tracking::stats m_start;
+  std::uint64_t m_live = 0;
+};
+#endif
+
+int main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+#ifdef MARK_FILES_ALLOC_TRACKING
+  heap_manager heap;
+  benchmark::RegisterMemoryManager(&heap);
+#endif
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
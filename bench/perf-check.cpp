@@ -0,0 +1,324 @@
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <regex>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <fmt/color.h>
+#include <winpp/parser.hpp>
+#include <fort.hpp>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::ordered_json;
+
+// performance regression gate: the microbenchmarks compared to a stored baseline
+// - each benchmark is repeated: its throughput is the median of the repetitions and its
+//   noise the median absolute deviation (mad)
+// - regression: the median is lower than the baseline by more than the tolerance and
+//   more than the noise of both runs (3 scaled mad)
+// - memory: the peak of the heap (allocation tracking builds) can't grow beyond its tolerance
+// - a benchmark of the baseline missing from the run is a regression (if selected by the filter),
+//   a missing baseline an error
+// - update with a filter: the selected benchmarks are replaced in the existing baseline
+// - exit code: 0 if no regression, 1 if regression, -1 on error
+
+/*============================================
+| Declaration
+==============================================*/
+// program version
+const std::string PROGRAM_NAME = "perf-check";
+const std::string PROGRAM_VERSION = "1.0.0";
+
+// scale of the mad to estimate the standard deviation of a normal distribution
+constexpr double g_mad_scale = 1.4826;
+
+// measure of one benchmark over its repetitions
+struct measure {
+  std::string unit;
+  double median = 0;
+  double mad = 0;
+  double max_bytes = 0;
+};
+
+/*============================================
+| Function definitions
+==============================================*/
+double median(std::vector<double> values)
+{
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  const std::size_t mid = values.size() / 2;
+  return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+// median absolute deviation
+double mad(const std::vector<double>& values)
+{
+  const double m = median(values);
+  std::vector<double> deviations;
+  for (const double v : values)
+    deviations.push_back(std::abs(v - m));
+  return median(deviations);
+}
+
+// duration in seconds of a time of google benchmark
+double to_seconds(const double time, const std::string& unit)
+{
+  if (unit == "ns")
+    return time / 1e9;
+  if (unit == "us")
+    return time / 1e6;
+  if (unit == "ms")
+    return time / 1e3;
+  return time;
+}
+
+// run the benchmarks and retrieve the measure of each one
+std::map<std::string, measure> run_benchmarks(const std::filesystem::path& bench,
+                                              const int repetitions,
+                                              const std::string& filter)
+{
+  const std::filesystem::path& out = std::filesystem::temp_directory_path() / "perf-check.json";
+  std::string cmd = fmt::format(R"("{}" --benchmark_repetitions={} --benchmark_out="{}" --benchmark_out_format=json)",
+    bench.u8string(), repetitions, out.u8string());
+  if (!filter.empty())
+    cmd += fmt::format(R"( --benchmark_filter="{}")", filter);
+
+  // cmd.exe removes the first and last quotes of the command
+#ifdef _WIN32
+  cmd = "\"" + cmd + "\"";
+#endif
+  if (std::system(cmd.c_str()) != 0)
+    throw std::runtime_error(fmt::format("the benchmarks have failed: \"{}\"", bench.u8string()));
+  std::ifstream file(out, std::ios::binary);
+  if (!file.good())
+    throw std::runtime_error(fmt::format("can't read file: \"{}\"", out.u8string()));
+  const json& results = json::parse(file);
+
+  // throughput of each repetition: items, bytes or iterations per second
+  std::map<std::string, std::vector<double>> runs;
+  std::map<std::string, measure> measures;
+  for (const auto& b : results.at("benchmarks"))
+  {
+    if (b.value("run_type", "iteration") != "iteration")
+      continue;
+    const std::string& name = b.value("run_name", b.at("name").get<std::string>());
+    measure& m = measures[name];
+    double value = 0;
+    if (b.contains("items_per_second"))
+      value = b.at("items_per_second").get<double>(), m.unit = "items/s";
+    else if (b.contains("bytes_per_second"))
+      value = b.at("bytes_per_second").get<double>(), m.unit = "bytes/s";
+    else
+    {
+      const double seconds = to_seconds(b.at("real_time").get<double>(), b.value("time_unit", "ns"));
+      value = seconds > 0 ? 1.0 / seconds : 0, m.unit = "iter/s";
+    }
+    runs[name].push_back(value);
+    if (b.contains("max_bytes_used"))
+      m.max_bytes = std::max(m.max_bytes, b.at("max_bytes_used").get<double>());
+  }
+  for (auto& [name, m] : measures)
+  {
+    m.median = median(runs[name]);
+    m.mad = mad(runs[name]);
+  }
+  std::error_code ec;
+  std::filesystem::remove(out, ec);
+  return measures;
+}
+
+std::map<std::string, measure> load_baseline(const std::filesystem::path& path)
+{
+  std::map<std::string, measure> measures;
+  std::ifstream file(path, std::ios::binary);
+  if (!file.good())
+    throw std::runtime_error(fmt::format("can't read file: \"{}\"", path.u8string()));
+  const json& baseline = json::parse(file);
+  for (const auto& [name, b] : baseline.at("benchmarks").items())
+    measures[name] = { b.at("unit").get<std::string>(),
+                       b.at("median").get<double>(),
+                       b.at("mad").get<double>(),
+                       b.value("max_bytes", 0.0) };
+  return measures;
+}
+
+void save_baseline(const std::filesystem::path& path, const std::map<std::string, measure>& measures, const int repetitions)
+{
+  json baseline;
+  baseline["repetitions"] = repetitions;
+  baseline["benchmarks"] = json::object();
+  for (const auto& [name, m] : measures)
+  {
+    json& b = baseline["benchmarks"][name];
+    b["unit"] = m.unit;
+    b["median"] = m.median;
+    b["mad"] = m.mad;
+    if (m.max_bytes > 0)
+      b["max_bytes"] = m.max_bytes;
+  }
+  if (path.has_parent_path())
+    std::filesystem::create_directories(path.parent_path());
+  std::ofstream file(path, std::ios::binary);
+  file << baseline.dump(2) << "\n";
+  if (!file.good())
+    throw std::runtime_error(fmt::format("can't write file: \"{}\"", path.u8string()));
+}
+
+// benchmark selected by the filter of the run (same search as --benchmark_filter)
+bool selected(const std::string& name, const std::string& filter)
+{
+  return filter.empty() || std::regex_search(name, std::regex(filter));
+}
+
+// compare the measures to the baseline and display the differences - returns the number of regressions
+// (including the benchmarks of the baseline selected by the filter which haven't been run)
+std::size_t compare(const std::map<std::string, measure>& baseline,
+                    const std::map<std::string, measure>& current,
+                    const std::string& filter,
+                    const double tolerance,
+                    const double memory_tolerance)
+{
+  auto rate = [](const double v, const std::string& unit) {
+    const char* prefixes[] = { "", "k", "M", "G", "T" };
+    std::size_t p = 0;
+    double value = v;
+    for (; value >= 1000 && p + 1 < std::size(prefixes); ++p)
+      value /= 1000;
+    return fmt::format("{:.2f} {}{}", value, prefixes[p], unit);
+  };
+
+  fort::utf8_table table;
+  table.set_border_style(FT_NICE_STYLE);
+  table.column(0).set_cell_text_align(fort::text_align::left);
+  table.column(0).set_cell_content_text_style(fort::text_style::bold);
+  for (std::size_t i = 1; i < 7; ++i)
+    table.column(i).set_cell_text_align(fort::text_align::right);
+  table << fort::header << "BENCHMARK" << "BASELINE" << "CURRENT" << "DIFF" << "NOISE" << "HEAP" << "STATUS" << fort::endr;
+
+  std::size_t nb_regressions = 0;
+  for (const auto& [name, cur] : current)
+  {
+    const auto it = baseline.find(name);
+    if (it == baseline.end())
+    {
+      table << name << "-" << rate(cur.median, cur.unit) << "-" << "-" << "-" << "new" << fort::endr;
+      continue;
+    }
+    const measure& base = it->second;
+
+    // relative difference and noise of both runs
+    const double diff = base.median > 0 ? (cur.median - base.median) / base.median : 0;
+    const double noise = base.median > 0 ? 3 * g_mad_scale * std::max(base.mad, cur.mad) / base.median : 0;
+    std::string status = "ok";
+    if (-diff > std::max(tolerance, noise))
+      status = "REGRESSION";
+    else if (diff > std::max(tolerance, noise))
+      status = "faster";
+
+    // growth of the peak of the heap
+    std::string heap = "-";
+    if (base.max_bytes > 0 && cur.max_bytes > 0)
+    {
+      const double growth = (cur.max_bytes - base.max_bytes) / base.max_bytes;
+      heap = fmt::format("{:+.1f}%", 100 * growth);
+      if (growth > memory_tolerance)
+        status = status == "REGRESSION" ? "REGRESSION + HEAP" : "HEAP";
+    }
+    if (status == "REGRESSION" || status == "HEAP" || status == "REGRESSION + HEAP")
+      ++nb_regressions;
+    table << name
+          << rate(base.median, base.unit)
+          << rate(cur.median, cur.unit)
+          << fmt::format("{:+.1f}%", 100 * diff)
+          << fmt::format("{:.1f}%", 100 * noise)
+          << heap
+          << status
+          << fort::endr;
+  }
+  for (const auto& [name, base] : baseline)
+    if (current.find(name) == current.end() && selected(name, filter))
+    {
+      table << name << rate(base.median, base.unit) << "-" << "-" << "-" << "-" << "MISSING" << fort::endr;
+      ++nb_regressions;
+    }
+  fmt::print("\n{}\n", table.to_string());
+  return nb_regressions;
+}
+
+int main(int argc, char** argv)
+{
+  // parse arguments
+  std::filesystem::path bench;
+  std::filesystem::path baseline;
+  int repetitions = 5;
+  int tolerance = 10;
+  int memory_tolerance = 10;
+  std::string filter;
+  bool update = false;
+  console::parser parser(PROGRAM_NAME, PROGRAM_VERSION);
+  parser.add("b", "bench", "set the benchmark executable (google benchmark)", bench)
+        .add("l", "baseline", "set the baseline (json file) of the benchmarks", baseline)
+        .add("r", "repetitions", "set the number of repetitions of each benchmark (default: 5)", repetitions)
+        .add("t", "tolerance", "set the tolerated drop of throughput in percent (default: 10)", tolerance)
+        .add("m", "memory-tolerance", "set the tolerated growth of the peak of the heap in percent (default: 10)", memory_tolerance)
+        .add("f", "filter", "only run the benchmarks matching this regex", filter)
+        .add("u", "update", "replace the baseline by the results of this run", update);
+  if (!parser.parse(argc, argv) || bench.empty() || baseline.empty())
+  {
+    parser.print_usage();
+    return -1;
+  }
+
+  try
+  {
+    if (repetitions < 2 || tolerance < 0 || memory_tolerance < 0)
+      throw std::runtime_error("at least 2 repetitions and positive tolerances are needed");
+    if (!update && !std::filesystem::exists(baseline))
+      throw std::runtime_error(fmt::format("no baseline: \"{}\" (record it with --update)", baseline.u8string()));
+    const std::map<std::string, measure>& current = run_benchmarks(bench, repetitions, filter);
+    if (current.empty())
+      throw std::runtime_error("no benchmark has been run");
+
+    // this run becomes the baseline - filtered: only its benchmarks are replaced
+    if (update)
+    {
+      std::map<std::string, measure> measures;
+      if (!filter.empty() && std::filesystem::exists(baseline))
+        for (const auto& [name, m] : load_baseline(baseline))
+          if (!selected(name, filter))
+            measures[name] = m;
+      for (const auto& [name, m] : current)
+        measures[name] = m;
+      save_baseline(baseline, measures, repetitions);
+      fmt::print("baseline of {} benchmark(s) saved ({} run): \"{}\"\n", measures.size(), current.size(), baseline.u8string());
+      return 0;
+    }
+
+    const std::size_t nb_regressions = compare(load_baseline(baseline), current, filter,
+      tolerance / 100.0, memory_tolerance / 100.0);
+    if (nb_regressions > 0)
+    {
+      fmt::print("{} {} benchmark(s) slower, bigger or missing compared to the baseline\n",
+        fmt::format(fmt::fg(fmt::color::red) | fmt::emphasis::bold, "error:"),
+        nb_regressions);
+      return 1;
+    }
+    fmt::print(fmt::fg(fmt::color::green) | fmt::emphasis::bold, "no regression\n");
+    return 0;
+  }
+  catch (const std::exception& ex)
+  {
+    fmt::print("{} {}\n",
+      fmt::format(fmt::fg(fmt::color::red) | fmt::emphasis::bold, "error:"),
+      ex.what());
+    return -1;
+  }
+}
@@ -0,0 +1,254 @@
+#pragma once
+#include <new>
+#include <string>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <fmt/core.h>
+#include <winpp/win.hpp>
+#ifdef MARK_FILES_ALLOC_TRACKING
+#include <dbghelp.h>
+#endif
+
+// tracking of the heap allocations: counts, bytes, peak of the live heap and allocation sites
+// - only compiled with the cmake option MARK_FILES_ALLOC_TRACKING: the global operator
+//   new/delete are replaced, so this header must be included by a single translation unit
+// - each block is prefixed by its size to account the bytes released by delete
+namespace alloc_tracking {
+
+#ifdef MARK_FILES_ALLOC_TRACKING
+  constexpr bool enabled = true;
+#else
+  constexpr bool enabled = false;
+#endif
+
+  // counters of the allocations (cumulative)
+  struct stats {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  // allocation site: return addresses of the callers of operator new
+  constexpr std::size_t site_depth = 8;
+  constexpr std::size_t max_sites = 16 * 1024;
+  struct site {
+    std::array<void*, site_depth> frames = {};
+    ULONG hash = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  inline thread_local stats t_stats;
+  inline thread_local bool t_inside = false;
+  inline std::atomic<std::uint64_t> g_allocations{ 0 };
+  inline std::atomic<std::uint64_t> g_bytes{ 0 };
+  inline std::atomic<std::int64_t> g_live{ 0 };
+  inline std::atomic<std::int64_t> g_peak{ 0 };
+  inline std::array<site, max_sites> g_sites;
+  inline std::mutex g_sites_mutex;
+  inline std::uint64_t g_lost_sites = 0;
+
+  // account one allocation and its site
+  inline void record(const std::size_t size)
+  {
+    ++t_stats.allocations;
+    t_stats.bytes += size;
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(size, std::memory_order_relaxed);
+    const std::int64_t live = g_live.fetch_add(static_cast<std::int64_t>(size), std::memory_order_relaxed) + static_cast<std::int64_t>(size);
+    std::int64_t peak = g_peak.load(std::memory_order_relaxed);
+    while (live > peak && !g_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+      ;
+
+    // no site for the allocations of the tracking itself (symbols)
+    if (t_inside)
+      return;
+    site s;
+    CaptureStackBackTrace(2, static_cast<DWORD>(site_depth), s.frames.data(), &s.hash);
+    std::lock_guard<std::mutex> lock(g_sites_mutex);
+    for (std::size_t i = 0; i < 16; ++i)
+    {
+      site& slot = g_sites[(s.hash + i) % max_sites];
+      if (slot.allocations == 0)
+      {
+        slot.frames = s.frames;
+        slot.hash = s.hash;
+      }
+      else if (slot.hash != s.hash || slot.frames != s.frames)
+        continue;
+      ++slot.allocations;
+      slot.bytes += size;
+      return;
+    }
+    ++g_lost_sites;
+  }
+
+  inline void release(const std::size_t size)
+  {
+    g_live.fetch_sub(static_cast<std::int64_t>(size), std::memory_order_relaxed);
+  }
+
+  // counters of the process
+  inline stats process_stats()
+  {
+    return { g_allocations.load(std::memory_order_relaxed), g_bytes.load(std::memory_order_relaxed) };
+  }
+
+  // counters of the calling thread
+  inline stats thread_stats()
+  {
+    return t_stats;
+  }
+
+  // peak of the live heap since the previous reset
+  inline std::uint64_t peak()
+  {
+    return static_cast<std::uint64_t>(std::max<std::int64_t>(0, g_peak.load(std::memory_order_relaxed)));
+  }
+
+  // size of the live heap
+  inline std::uint64_t live()
+  {
+    return static_cast<std::uint64_t>(std::max<std::int64_t>(0, g_live.load(std::memory_order_relaxed)));
+  }
+
+  inline void reset_peak()
+  {
+    g_peak.store(g_live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+
+  // allocation sites sorted by number of allocations
+  inline std::vector<site> top_sites(const std::size_t count)
+  {
+    // the sites aren't recorded while the table is locked
+    std::vector<site> sites;
+    t_inside = true;
+    {
+      std::lock_guard<std::mutex> lock(g_sites_mutex);
+      for (const auto& s : g_sites)
+        if (s.allocations > 0)
+          sites.push_back(s);
+    }
+    t_inside = false;
+    std::sort(sites.begin(), sites.end(), [](const site& a, const site& b) {
+      return a.allocations > b.allocations;
+      });
+    if (sites.size() > count)
+      sites.resize(count);
+    return sites;
+  }
+
+  // name of the functions of a site (callers of the allocation, innermost first)
+  inline std::string describe(const site& s)
+  {
+#ifdef MARK_FILES_ALLOC_TRACKING
+    const HANDLE process = GetCurrentProcess();
+    t_inside = true;
+    static const bool initialized = [&]() {
+      SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
+      return SymInitialize(process, nullptr, TRUE) != FALSE;
+    }();
+    std::string str;
+    for (void* frame : s.frames)
+    {
+      if (!frame)
+        break;
+      std::string name = fmt::format("{}", frame);
+      alignas(SYMBOL_INFO) char buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME];
+      SYMBOL_INFO* symbol = reinterpret_cast<SYMBOL_INFO*>(buffer);
+      symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+      symbol->MaxNameLen = MAX_SYM_NAME;
+      DWORD64 displacement = 0;
+      if (initialized && SymFromAddr(process, reinterpret_cast<DWORD64>(frame), &displacement, symbol))
+        name = symbol->Name;
+
+      // the allocators of the standard library aren't significant
+      if (name.rfind("std::", 0) == 0 || name.rfind("operator new", 0) == 0)
+        continue;
+      IMAGEHLP_LINE64 line = {};
+      line.SizeOfStruct = sizeof(line);
+      DWORD offset = 0;
+      if (initialized && SymGetLineFromAddr64(process, reinterpret_cast<DWORD64>(frame), &offset, &line))
+        name += fmt::format(" ({}:{})", std::string(line.FileName).substr(std::string(line.FileName).find_last_of("\\/") + 1), line.LineNumber);
+      str += str.empty() ? name : " < " + name;
+    }
+    t_inside = false;
+    return str.empty() ? "standard library" : str;
+#else
+    return fmt::format("{}", s.frames[0]);
+#endif
+  }
+}
+
+#ifdef MARK_FILES_ALLOC_TRACKING
+// replaced global allocation functions: block = size prefix (16 bytes, keeps the alignment) + data
+void* operator new(std::size_t size)
+{
+  void* p = std::malloc(size + 16);
+  if (!p)
+    throw std::bad_alloc();
+  *static_cast<std::size_t*>(p) = size;
+  alloc_tracking::record(size);
+  return static_cast<char*>(p) + 16;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  try
+  {
+    return operator new(size);
+  }
+  catch (...)
+  {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+  if (!p)
+    return;
+  void* block = static_cast<char*>(p) - 16;
+  alloc_tracking::release(*static_cast<std::size_t*>(block));
+  std::free(block);
+}
+
+void operator delete[](void* p) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+  operator delete(p);
+}
+#endif
@@ -0,0 +1,669 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <ctime>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <zlib.h>
+#include <zstd.h>
+#include "database.hpp"
+#include "mapped-file.hpp"
+#include "sha256.hpp"
+
+// hash of the members of tar (plain, gzip, zstd) and zip archives without extraction
+// - members are recorded as virtual paths: archive!/dir/file
+// - their timestamps are the archived modification time (ctime = mtime)
+// - the archive itself is hashed during the same read
+namespace archive {
+
+  // separator between the archive path and the member path
+  constexpr char separator[] = "!/";
+
+  // size of the read chunks
+  constexpr std::size_t chunk_size = 1024 * 1024;
+
+  enum class kind { none, tar, tar_gz, tar_zst, zip };
+
+  // detect the kind of archive from the file name
+  inline kind get_kind(const std::filesystem::path& file)
+  {
+    std::string name = file.filename().u8string();
+    std::transform(name.begin(), name.end(), name.begin(), [](const char c) {
+      return static_cast<char>((c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c);
+      });
+    auto ends_with = [&](const std::string_view& ext) {
+      return name.size() > ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    if (ends_with(".tar"))
+      return kind::tar;
+    if (ends_with(".tar.gz") || ends_with(".tgz"))
+      return kind::tar_gz;
+    if (ends_with(".tar.zst") || ends_with(".tzst"))
+      return kind::tar_zst;
+    if (ends_with(".zip"))
+      return kind::zip;
+    return kind::none;
+  }
+
+  // check if a database name is a member of an archive
+  inline bool is_member(const std::string_view& name)
+  {
+    return name.find(separator) != std::string_view::npos;
+  }
+
+  // sequential source of bytes
+  class source {
+  public:
+    virtual ~source() = default;
+
+    // read up to len bytes - 0 at the end
+    virtual std::size_t read(std::uint8_t* data, std::size_t len) = 0;
+
+    // read exactly len bytes - false at the end
+    bool read_exact(std::uint8_t* data, std::size_t len)
+    {
+      while (len > 0)
+      {
+        const std::size_t n = read(data, len);
+        if (n == 0)
+          return false;
+        data += n;
+        len -= n;
+      }
+      return true;
+    }
+  };
+
+  // raw file - every byte read is hashed
+  class file_source : public source {
+  public:
+    explicit file_source(const std::filesystem::path& path) :
+      m_path(path),
+      m_file(path, std::ios::binary)
+    {
+      if (!m_file.good())
+        throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.u8string()));
+    }
+
+    std::size_t read(std::uint8_t* data, std::size_t len) override
+    {
+      m_file.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(len));
+      const std::size_t n = static_cast<std::size_t>(m_file.gcount());
+      if (n == 0 && m_file.bad())
+        throw std::runtime_error(fmt::format("can't read file: \"{}\"", m_path.u8string()));
+      m_hash.update(data, n);
+      return n;
+    }
+
+    // hash of the whole file (read up to its end)
+    std::string hex()
+    {
+      std::vector<std::uint8_t> buffer(chunk_size);
+      while (read(buffer.data(), buffer.size()) > 0)
+        ;
+      return m_hash.hex();
+    }
+
+  private:
+    const std::filesystem::path m_path;
+    std::ifstream m_file;
+    sha256 m_hash;
+  };
+
+  // gzip stream (possibly made of several members)
+  class gzip_source : public source {
+  public:
+    explicit gzip_source(source& in) :
+      m_in(in),
+      m_buffer(chunk_size)
+    {
+      if (inflateInit2(&m_stream, 15 + 32) != Z_OK)
+        throw std::runtime_error("can't initialize gzip decoder");
+    }
+
+    ~gzip_source()
+    {
+      inflateEnd(&m_stream);
+    }
+
+    std::size_t read(std::uint8_t* data, std::size_t len) override
+    {
+      m_stream.next_out = data;
+      m_stream.avail_out = static_cast<uInt>(len);
+      while (m_stream.avail_out == len && !m_end)
+      {
+        if (m_stream.avail_in == 0)
+        {
+          m_stream.next_in = m_buffer.data();
+          m_stream.avail_in = static_cast<uInt>(m_in.read(m_buffer.data(), m_buffer.size()));
+          if (m_stream.avail_in == 0)
+          {
+            m_end = true;
+            break;
+          }
+        }
+        const int ret = inflate(&m_stream, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+          // concatenated members
+          if (inflateReset(&m_stream) != Z_OK)
+            throw std::runtime_error("corrupted gzip stream");
+        }
+        else if (ret != Z_OK)
+          throw std::runtime_error("corrupted gzip stream");
+      }
+      return len - m_stream.avail_out;
+    }
+
+  private:
+    source& m_in;
+    std::vector<std::uint8_t> m_buffer;
+    z_stream m_stream = {};
+    bool m_end = false;
+  };
+
+  // zstd stream
+  class zstd_source : public source {
+  public:
+    explicit zstd_source(source& in) :
+      m_in(in),
+      m_buffer(ZSTD_DStreamInSize()),
+      m_stream(ZSTD_createDStream())
+    {
+      if (!m_stream)
+        throw std::runtime_error("can't initialize zstd decoder");
+    }
+
+    ~zstd_source()
+    {
+      ZSTD_freeDStream(m_stream);
+    }
+
+    std::size_t read(std::uint8_t* data, std::size_t len) override
+    {
+      ZSTD_outBuffer out = { data, len, 0 };
+      while (out.pos == 0 && !m_end)
+      {
+        if (m_input.pos == m_input.size)
+        {
+          m_input = { m_buffer.data(), m_in.read(m_buffer.data(), m_buffer.size()), 0 };
+          if (m_input.size == 0)
+          {
+            m_end = true;
+            break;
+          }
+        }
+        const std::size_t ret = ZSTD_decompressStream(m_stream, &out, &m_input);
+        if (ZSTD_isError(ret))
+          throw std::runtime_error(fmt::format("corrupted zstd stream: {}", ZSTD_getErrorName(ret)));
+      }
+      return out.pos;
+    }
+
+  private:
+    source& m_in;
+    std::vector<std::uint8_t> m_buffer;
+    ZSTD_DStream* m_stream;
+    ZSTD_inBuffer m_input = { nullptr, 0, 0 };
+    bool m_end = false;
+  };
+
+  // parse a numeric field of a tar header (octal or base-256)
+  inline std::uint64_t tar_number(const std::uint8_t* field, const std::size_t len)
+  {
+    std::uint64_t v = 0;
+    if (field[0] & 0x80)
+    {
+      for (std::size_t i = 1; i < len; ++i)
+        v = (v << 8) | field[i];
+      return v;
+    }
+    for (std::size_t i = 0; i < len && field[i]; ++i)
+      if (field[i] >= '0' && field[i] <= '7')
+        v = (v << 3) | static_cast<std::uint64_t>(field[i] - '0');
+    return v;
+  }
+
+  // string field of a tar header (not always terminated)
+  inline std::string tar_string(const std::uint8_t* field, const std::size_t len)
+  {
+    const char* s = reinterpret_cast<const char*>(field);
+    return std::string(s, std::find(s, s + len, '\0'));
+  }
+
+  // length of the valid utf-8 sequence at the start of a string (0 if invalid)
+  inline std::size_t utf8_length(const std::string& s, const std::size_t pos)
+  {
+    const unsigned char c = static_cast<unsigned char>(s[pos]);
+    std::size_t len = 0;
+    std::uint32_t cp = 0;
+    if (c < 0x80)
+      return 1;
+    else if (c >= 0xC2 && c <= 0xDF)
+      len = 2, cp = c & 0x1F;
+    else if (c >= 0xE0 && c <= 0xEF)
+      len = 3, cp = c & 0x0F;
+    else if (c >= 0xF0 && c <= 0xF4)
+      len = 4, cp = c & 0x07;
+    else
+      return 0;
+    if (pos + len > s.size())
+      return 0;
+    for (std::size_t i = 1; i < len; ++i)
+    {
+      const unsigned char n = static_cast<unsigned char>(s[pos + i]);
+      if ((n & 0xC0) != 0x80)
+        return 0;
+      cp = (cp << 6) | (n & 0x3F);
+    }
+    // overlong forms, surrogates and code points above the unicode range
+    if ((len == 3 && cp < 0x800) || (len == 4 && (cp < 0x10000 || cp > 0x10FFFF)) || (cp >= 0xD800 && cp <= 0xDFFF))
+      return 0;
+    return len;
+  }
+
+  inline void append_utf8(std::string& s, const std::uint32_t cp)
+  {
+    if (cp < 0x80)
+      s += static_cast<char>(cp);
+    else if (cp < 0x800)
+    {
+      s += static_cast<char>(0xC0 | (cp >> 6));
+      s += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+      s += static_cast<char>(0xE0 | (cp >> 12));
+      s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      s += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+
+  // name of a member in utf-8 (the names of the database are utf-8)
+  // - zip names without the utf-8 flag are in the ibm code page 437 (unless valid utf-8)
+  // - other invalid bytes are replaced by U+FFFD
+  inline std::string to_utf8(const std::string& name, const bool cp437 = false)
+  {
+    static const std::uint16_t cp437_high[128] = {
+      0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7, 0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+      0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9, 0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+      0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA, 0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+      0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556, 0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+      0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F, 0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+      0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B, 0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+      0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4, 0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+      0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248, 0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0
+    };
+    bool valid = true;
+    for (std::size_t pos = 0, len = 0; valid && pos < name.size(); pos += len)
+      valid = (len = utf8_length(name, pos)) > 0;
+    if (valid)
+      return name;
+
+    std::string str;
+    for (std::size_t pos = 0; pos < name.size();)
+    {
+      const unsigned char c = static_cast<unsigned char>(name[pos]);
+      const std::size_t len = cp437 ? (c < 0x80 ? 1 : 0) : utf8_length(name, pos);
+      if (len > 0)
+        str.append(name, pos, len), pos += len;
+      else
+      {
+        append_utf8(str, cp437 ? cp437_high[c - 0x80] : 0xFFFD);
+        ++pos;
+      }
+    }
+    return str;
+  }
+
+  // hash all the regular members of a tar stream
+  inline void read_tar(source& in, const std::string& prefix, std::vector<db_record>& members)
+  {
+    std::vector<std::uint8_t> buffer(chunk_size);
+    std::array<std::uint8_t, 512> header;
+    std::string long_name;
+    std::string pax_path;
+    std::uint64_t pax_mtime = 0;
+    bool has_pax_mtime = false;
+    while (in.read_exact(header.data(), header.size()))
+    {
+      // end of archive: zero block
+      if (std::all_of(header.begin(), header.end(), [](const std::uint8_t b) { return b == 0; }))
+        break;
+
+      const char type = static_cast<char>(header[156]);
+      const std::uint64_t size = tar_number(&header[124], 12);
+      std::string name = tar_string(&header[0], 100);
+      // prefix of the posix format only: the old gnu format ("ustar  ") stores times at this offset
+      if (std::memcmp(&header[257], "ustar\0" "00", 8) == 0 && header[345] != 0)
+        name = tar_string(&header[345], 155) + "/" + name;
+
+      // gnu long name and pax headers: content read in memory
+      if (type == 'L' || type == 'x' || type == 'g')
+      {
+        std::string content(static_cast<std::size_t>(size), '\0');
+        if (!in.read_exact(reinterpret_cast<std::uint8_t*>(content.data()), content.size()))
+          throw std::runtime_error("truncated tar archive");
+        if (type == 'L')
+          long_name = content.c_str();
+        else if (type == 'x')
+        {
+          // records: "<length> <key>=<value>\n"
+          std::size_t pos = 0;
+          while (pos < content.size())
+          {
+            const std::size_t space = content.find(' ', pos);
+            if (space == std::string::npos)
+              break;
+            const std::size_t len = std::strtoull(content.c_str() + pos, nullptr, 10);
+            if (len == 0 || pos + len > content.size())
+              break;
+            const std::string record = content.substr(space + 1, pos + len - space - 2);
+            const std::size_t equal = record.find('=');
+            if (equal != std::string::npos)
+            {
+              const std::string key = record.substr(0, equal);
+              if (key == "path")
+                pax_path = record.substr(equal + 1);
+              else if (key == "mtime")
+              {
+                pax_mtime = std::strtoull(record.c_str() + equal + 1, nullptr, 10);
+                has_pax_mtime = true;
+              }
+            }
+            pos += len;
+          }
+        }
+      }
+      else if (type == '0' || type == '\0' || type == '7')
+      {
+        // regular member: hashed while read
+        file_infos infos;
+        infos.mtime = has_pax_mtime ? pax_mtime : tar_number(&header[136], 12);
+        infos.ctime = infos.mtime;
+        infos.size = size;
+        sha256 hash;
+        for (std::uint64_t left = size; left > 0;)
+        {
+          const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(left, buffer.size()));
+          if (!in.read_exact(buffer.data(), n))
+            throw std::runtime_error("truncated tar archive");
+          hash.update(buffer.data(), n);
+          left -= n;
+        }
+        infos.sha = hash.hex();
+        if (!pax_path.empty())
+          name = pax_path;
+        else if (!long_name.empty())
+          name = long_name;
+        members.emplace_back(prefix + to_utf8(name), std::move(infos));
+      }
+      else
+      {
+        // other members (directories, links...): data skipped
+        for (std::uint64_t left = size; left > 0;)
+        {
+          const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(left, buffer.size()));
+          if (!in.read_exact(buffer.data(), n))
+            throw std::runtime_error("truncated tar archive");
+          left -= n;
+        }
+      }
+      if (type != 'L' && type != 'x' && type != 'g')
+      {
+        long_name.clear();
+        pax_path.clear();
+        has_pax_mtime = false;
+      }
+
+      // data padded to 512 bytes
+      const std::size_t padding = static_cast<std::size_t>((512 - size % 512) % 512);
+      if (padding > 0 && !in.read_exact(buffer.data(), padding))
+        throw std::runtime_error("truncated tar archive");
+    }
+  }
+
+  // little-endian fields of zip structures
+  inline std::uint16_t le16(const std::uint8_t* p)
+  {
+    return static_cast<std::uint16_t>(p[0] | (p[1] << 8));
+  }
+
+  inline std::uint32_t le32(const std::uint8_t* p)
+  {
+    return static_cast<std::uint32_t>(le16(p)) | (static_cast<std::uint32_t>(le16(p + 2)) << 16);
+  }
+
+  inline std::uint64_t le64(const std::uint8_t* p)
+  {
+    return static_cast<std::uint64_t>(le32(p)) | (static_cast<std::uint64_t>(le32(p + 4)) << 32);
+  }
+
+  // convert a ms-dos date/time (local time) to a timestamp
+  inline std::uint64_t dos_time(const std::uint16_t date, const std::uint16_t time)
+  {
+    std::tm tm = {};
+    tm.tm_year = ((date >> 9) & 0x7F) + 80;
+    tm.tm_mon = ((date >> 5) & 0x0F) - 1;
+    tm.tm_mday = date & 0x1F;
+    tm.tm_hour = (time >> 11) & 0x1F;
+    tm.tm_min = (time >> 5) & 0x3F;
+    tm.tm_sec = (time & 0x1F) * 2;
+    tm.tm_isdst = -1;
+    const std::time_t t = std::mktime(&tm);
+    return t < 0 ? 0 : static_cast<std::uint64_t>(t);
+  }
+
+  // hash all the members of a zip archive (central directory + members in file order)
+  // - skipped: members which can't be hashed (encrypted, compression other than stored/deflate)
+  inline void read_zip(const std::uint8_t* data,
+                       const std::uint64_t size,
+                       const std::string& prefix,
+                       std::vector<db_record>& members,
+                       std::vector<std::string>& skipped)
+  {
+    auto check = [&](const std::uint64_t offset, const std::uint64_t len) {
+      if (offset > size || len > size - offset)
+        throw std::runtime_error("corrupted zip archive");
+    };
+
+    // find the end of central directory
+    if (size < 22)
+      throw std::runtime_error("corrupted zip archive");
+    std::uint64_t eocd = size - 22;
+    const std::uint64_t min = size > 22 + 0xFFFF ? size - 22 - 0xFFFF : 0;
+    while (le32(data + eocd) != 0x06054b50)
+    {
+      if (eocd == min)
+        throw std::runtime_error("corrupted zip archive");
+      --eocd;
+    }
+    std::uint64_t count = le16(data + eocd + 10);
+    std::uint64_t cd_offset = le32(data + eocd + 16);
+
+    // zip64 end of central directory
+    if ((count == 0xFFFF || cd_offset == 0xFFFFFFFF) && eocd >= 20 && le32(data + eocd - 20) == 0x07064b50)
+    {
+      const std::uint64_t eocd64 = le64(data + eocd - 20 + 8);
+      check(eocd64, 56);
+      if (le32(data + eocd64) != 0x06064b50)
+        throw std::runtime_error("corrupted zip archive");
+      count = le64(data + eocd64 + 32);
+      cd_offset = le64(data + eocd64 + 48);
+    }
+
+    // read the central directory
+    struct member {
+      std::string name;
+      std::uint16_t method;
+      std::uint64_t csize;
+      std::uint64_t usize;
+      std::uint64_t offset;
+      std::uint64_t mtime;
+    };
+    std::vector<member> entries;
+    std::uint64_t pos = cd_offset;
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+      check(pos, 46);
+      const std::uint8_t* p = data + pos;
+      if (le32(p) != 0x02014b50)
+        throw std::runtime_error("corrupted zip archive");
+      const std::uint16_t flags = le16(p + 8);
+      member m;
+      m.method = le16(p + 10);
+      m.mtime = dos_time(le16(p + 14), le16(p + 12));
+      m.csize = le32(p + 20);
+      m.usize = le32(p + 24);
+      m.offset = le32(p + 42);
+      const std::uint16_t name_len = le16(p + 28);
+      const std::uint16_t extra_len = le16(p + 30);
+      const std::uint16_t comment_len = le16(p + 32);
+      check(pos + 46, static_cast<std::uint64_t>(name_len) + extra_len + comment_len);
+      m.name.assign(reinterpret_cast<const char*>(p + 46), name_len);
+      m.name = to_utf8(m.name, !(flags & 0x0800));
+
+      // extra fields: zip64 sizes/offset and unix modification time
+      for (const std::uint8_t* e = p + 46 + name_len; e + 4 <= p + 46 + name_len + extra_len;)
+      {
+        const std::uint16_t id = le16(e);
+        const std::uint16_t len = le16(e + 2);
+        const std::uint8_t* v = e + 4;
+        const std::uint8_t* end = std::min(v + len, p + 46 + name_len + extra_len);
+        if (id == 0x0001)
+        {
+          if (m.usize == 0xFFFFFFFF && v + 8 <= end) { m.usize = le64(v); v += 8; }
+          if (m.csize == 0xFFFFFFFF && v + 8 <= end) { m.csize = le64(v); v += 8; }
+          if (m.offset == 0xFFFFFFFF && v + 8 <= end) { m.offset = le64(v); v += 8; }
+        }
+        else if (id == 0x5455 && len >= 5 && (v[0] & 1))
+          m.mtime = le32(v + 1);
+        e += 4 + len;
+      }
+      pos += 46 + name_len + extra_len + comment_len;
+
+      // only regular members (directories skipped) - encrypted: reported
+      if (m.name.empty() || m.name.back() == '/')
+        continue;
+      if (flags & 1)
+        skipped.push_back(fmt::format("{} (encrypted)", m.name));
+      else
+        entries.push_back(std::move(m));
+    }
+
+    // hash the members in the order of the file (sequential read)
+    std::sort(entries.begin(), entries.end(), [](const member& a, const member& b) {
+      return a.offset < b.offset;
+      });
+    std::vector<std::uint8_t> buffer(chunk_size);
+    for (const auto& m : entries)
+    {
+      check(m.offset, 30);
+      const std::uint8_t* p = data + m.offset;
+      if (le32(p) != 0x04034b50)
+        throw std::runtime_error("corrupted zip archive");
+      const std::uint64_t start = m.offset + 30 + le16(p + 26) + le16(p + 28);
+      check(start, m.csize);
+
+      sha256 hash;
+      if (m.method == 0)
+        hash.update(data + start, static_cast<std::size_t>(m.csize));
+      else if (m.method == 8)
+      {
+        // raw deflate
+        z_stream stream = {};
+        if (inflateInit2(&stream, -15) != Z_OK)
+          throw std::runtime_error("can't initialize deflate decoder");
+        stream.next_in = const_cast<Bytef*>(data + start);
+        int ret = Z_OK;
+        std::uint64_t left = m.csize;
+        while (ret != Z_STREAM_END)
+        {
+          if (stream.avail_in == 0)
+          {
+            stream.avail_in = static_cast<uInt>(std::min<std::uint64_t>(left, 0x40000000));
+            left -= stream.avail_in;
+          }
+          stream.next_out = buffer.data();
+          stream.avail_out = static_cast<uInt>(buffer.size());
+          ret = inflate(&stream, Z_NO_FLUSH);
+          if (ret != Z_OK && ret != Z_STREAM_END)
+          {
+            inflateEnd(&stream);
+            throw std::runtime_error("corrupted zip archive");
+          }
+          hash.update(buffer.data(), buffer.size() - stream.avail_out);
+          if (ret == Z_OK && stream.avail_in == 0 && left == 0 && stream.avail_out != 0)
+          {
+            inflateEnd(&stream);
+            throw std::runtime_error("truncated zip archive");
+          }
+        }
+        inflateEnd(&stream);
+      }
+      else
+      {
+        skipped.push_back(fmt::format("{} (compression method {})", m.name, m.method));
+        continue;
+      }
+      members.emplace_back(prefix + m.name, file_infos{ hash.hex(), m.mtime, m.mtime, m.usize });
+    }
+  }
+
+  // hash an archive and all its members - members are sorted by name
+  // - a name found several times (appended tar members): the last one wins, as on extraction
+  // - skipped: members which can't be hashed
+  inline std::string read(const std::filesystem::path& file,
+                          std::vector<db_record>& members,
+                          std::vector<std::string>& skipped)
+  {
+    const std::string& prefix = file.u8string() + separator;
+    std::string sha;
+    const kind k = get_kind(file);
+    if (k == kind::zip)
+    {
+      const mapped_file mapping(file);
+      sha256 hash;
+      hash.update(mapping.data(), static_cast<std::size_t>(mapping.size()));
+      sha = hash.hex();
+      read_zip(mapping.data(), mapping.size(), prefix, members, skipped);
+    }
+    else
+    {
+      file_source raw(file);
+      if (k == kind::tar_gz)
+      {
+        gzip_source in(raw);
+        read_tar(in, prefix, members);
+      }
+      else if (k == kind::tar_zst)
+      {
+        zstd_source in(raw);
+        read_tar(in, prefix, members);
+      }
+      else
+        read_tar(raw, prefix, members);
+      sha = raw.hex();
+    }
+    std::stable_sort(members.begin(), members.end(), [](const db_record& a, const db_record& b) {
+      return a.first < b.first;
+      });
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < members.size(); ++i)
+    {
+      if (n > 0 && members[n - 1].first == members[i].first)
+        members[n - 1] = std::move(members[i]);
+      else if (n++ != i)
+        members[n - 1] = std::move(members[i]);
+    }
+    members.resize(n);
+    return sha;
+  }
+}
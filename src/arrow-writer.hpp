@@ -0,0 +1,140 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/properties.h>
+#include "result-writer.hpp"
+
+// columnar output of the results: parquet file or arrow ipc stream
+// - results are accumulated in column builders and written by batches (row groups)
+// - the directory is dictionary-encoded (int32 indices, as declared by the schema), the digest is a fixed-size binary column
+class arrow_writer : public result_writer {
+public:
+  enum class format { parquet, arrow };
+
+  arrow_writer(const std::filesystem::path& path,
+               const format fmt,
+               const std::size_t row_group_size) :
+    m_format(fmt),
+    m_row_group_size(row_group_size),
+    m_schema(arrow::schema({
+      arrow::field("dir", arrow::dictionary(arrow::int32(), arrow::utf8()), false),
+      arrow::field("name", arrow::utf8(), false),
+      arrow::field("sha", arrow::fixed_size_binary(32), true),
+      arrow::field("ctime", arrow::uint64(), false),
+      arrow::field("mtime", arrow::uint64(), false),
+      arrow::field("size", arrow::uint64(), false) })),
+    m_sha(arrow::fixed_size_binary(32))
+  {
+    m_file = unwrap(arrow::io::FileOutputStream::Open(path.u8string()));
+    if (m_format == format::parquet)
+    {
+      const std::shared_ptr<parquet::WriterProperties>& props = parquet::WriterProperties::Builder()
+        .max_row_group_length(static_cast<int64_t>(m_row_group_size))
+        ->compression(parquet::Compression::ZSTD)
+        ->build();
+      const std::shared_ptr<parquet::ArrowWriterProperties>& arrow_props = parquet::ArrowWriterProperties::Builder()
+        .store_schema()
+        ->build();
+      m_parquet = unwrap(parquet::arrow::FileWriter::Open(*m_schema, arrow::default_memory_pool(), m_file, props, arrow_props));
+    }
+    else
+    {
+      // stream format: each batch can carry its own dictionary
+      m_ipc = unwrap(arrow::ipc::MakeStreamWriter(m_file, m_schema));
+    }
+    start();
+  }
+
+  ~arrow_writer()
+  {
+    stop();
+  }
+
+protected:
+  void write(const db_record& record) override
+  {
+    const auto& [name, infos] = record;
+    const std::size_t pos = name.find_last_of("\\/");
+    const std::string_view path(name);
+    check(m_dir.Append(pos == std::string::npos ? std::string_view() : path.substr(0, pos)));
+    check(m_name.Append(pos == std::string::npos ? path : path.substr(pos + 1)));
+    digest d;
+    if (to_digest(infos.sha, d))
+      check(m_sha.Append(d.data()));
+    else
+      check(m_sha.AppendNull());
+    check(m_ctime.Append(infos.ctime));
+    check(m_mtime.Append(infos.mtime));
+    check(m_size.Append(infos.size));
+    if (++m_rows >= m_row_group_size)
+      flush();
+  }
+
+  void finish() override
+  {
+    flush();
+    if (m_parquet)
+      check(m_parquet->Close());
+    if (m_ipc)
+      check(m_ipc->Close());
+    check(m_file->Close());
+  }
+
+private:
+  // write the accumulated rows as one batch (row group)
+  void flush()
+  {
+    if (m_rows == 0)
+      return;
+    std::shared_ptr<arrow::Array> dir, name, sha, ctime, mtime, size;
+    check(m_dir.Finish(&dir));
+    check(m_name.Finish(&name));
+    check(m_sha.Finish(&sha));
+    check(m_ctime.Finish(&ctime));
+    check(m_mtime.Finish(&mtime));
+    check(m_size.Finish(&size));
+    const std::shared_ptr<arrow::RecordBatch>& batch = arrow::RecordBatch::Make(
+      m_schema, static_cast<int64_t>(m_rows), { dir, name, sha, ctime, mtime, size });
+    check(batch->Validate());
+    if (m_parquet)
+      check(m_parquet->WriteTable(*unwrap(arrow::Table::FromRecordBatches({ batch })), static_cast<int64_t>(m_rows)));
+    else
+      check(m_ipc->WriteRecordBatch(*batch));
+    m_rows = 0;
+  }
+
+  static void check(const arrow::Status& status)
+  {
+    if (!status.ok())
+      throw std::runtime_error(fmt::format("arrow error: {}", status.ToString()));
+  }
+
+  template<typename T>
+  static T unwrap(arrow::Result<T>&& result)
+  {
+    check(result.status());
+    return std::move(result).ValueUnsafe();
+  }
+
+  const format m_format;
+  const std::size_t m_row_group_size;
+  std::shared_ptr<arrow::Schema> m_schema;
+  std::shared_ptr<arrow::io::FileOutputStream> m_file;
+  std::unique_ptr<parquet::arrow::FileWriter> m_parquet;
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> m_ipc;
+  arrow::StringDictionary32Builder m_dir;
+  arrow::StringBuilder m_name;
+  arrow::FixedSizeBinaryBuilder m_sha;
+  arrow::UInt64Builder m_ctime;
+  arrow::UInt64Builder m_mtime;
+  arrow::UInt64Builder m_size;
+  std::size_t m_rows = 0;
+};
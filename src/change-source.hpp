@@ -0,0 +1,397 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include <set>
+#include <map>
+#include <optional>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/utf8.hpp>
+#include <winpp/win.hpp>
+#include <winioctl.h>
+#include "database.hpp"
+#include "enumerate.hpp"
+#include "archive.hpp"
+
+// files changed since a previous scan listed by the file system (no full enumeration)
+// - ntfs: update sequence number (usn) journal of the volume
+// - or an external list of files (e.g. written by a backup tool)
+// - the position of the journal at the time of the scan is saved next to the database
+namespace change_source {
+
+  // position in the change list of a volume
+  struct position {
+    std::uint64_t journal_id = 0;
+    std::int64_t usn = 0;
+  };
+
+  // files and directories (renamed or deleted: all their content) changed between two positions
+  struct changes {
+    std::set<std::string> files;
+    std::set<std::string> dirs;
+  };
+
+  // file system providing the list of its changes
+  class source {
+  public:
+    virtual ~source() = default;
+
+    // current position (taken before the scan)
+    virtual position current() = 0;
+
+    // changes of the tree between two positions - false if they aren't available anymore
+    virtual bool list(const position& from, const position& to, changes& result) = 0;
+  };
+
+  // ntfs usn journal (needs administrator rights to open the volume)
+  class usn_journal : public source {
+  public:
+    explicit usn_journal(const std::filesystem::path& root) :
+      m_root(root)
+    {
+      // volume of the tree: \\.\C:
+      wchar_t mount[MAX_PATH];
+      if (!GetVolumePathNameW(std::filesystem::absolute(root).wstring().c_str(), mount, MAX_PATH))
+        throw std::runtime_error(fmt::format("can't retrieve the volume of: \"{}\"", root.u8string()));
+      std::wstring volume = L"\\\\.\\" + std::wstring(mount);
+      if (!volume.empty() && volume.back() == L'\\')
+        volume.pop_back();
+      m_volume = CreateFileW(volume.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                             OPEN_EXISTING, 0, nullptr);
+      if (m_volume == INVALID_HANDLE_VALUE)
+        throw std::runtime_error(fmt::format("can't open the volume of: \"{}\" (administrator rights needed)", root.u8string()));
+
+      // name of the root as returned for the changed files
+      const HANDLE handle = CreateFileW(root.wstring().c_str(), FILE_READ_ATTRIBUTES,
+                                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+      if (handle != INVALID_HANDLE_VALUE)
+      {
+        m_final_root = final_path(handle);
+        CloseHandle(handle);
+      }
+      if (m_final_root.empty())
+      {
+        CloseHandle(m_volume);
+        throw std::runtime_error(fmt::format("can't open directory: \"{}\"", root.u8string()));
+      }
+    }
+
+    ~usn_journal()
+    {
+      CloseHandle(m_volume);
+    }
+    usn_journal(const usn_journal&) = delete;
+    usn_journal& operator=(const usn_journal&) = delete;
+
+    position current() override
+    {
+      USN_JOURNAL_DATA_V0 data;
+      DWORD bytes = 0;
+      if (!DeviceIoControl(m_volume, FSCTL_QUERY_USN_JOURNAL, nullptr, 0, &data, sizeof(data), &bytes, nullptr))
+        throw std::runtime_error(fmt::format("no usn journal on the volume of: \"{}\"", m_root.u8string()));
+      m_lowest = data.LowestValidUsn;
+      return { static_cast<std::uint64_t>(data.UsnJournalID), static_cast<std::int64_t>(data.NextUsn) };
+    }
+
+    bool list(const position& from, const position& to, changes& result) override
+    {
+      // journal recreated or records already purged
+      if (from.journal_id != to.journal_id || from.usn < m_lowest || from.usn > to.usn)
+        return false;
+
+      // read all the records: the directories deleted later are only known by their records
+      struct record {
+        std::uint64_t parent;
+        std::wstring name;
+        DWORD reason;
+        bool dir;
+      };
+      std::vector<record> records;
+      std::vector<std::uint64_t> buffer(128 * 1024);
+      READ_USN_JOURNAL_DATA_V0 read = {};
+      read.StartUsn = from.usn;
+      read.ReasonMask = 0xFFFFFFFF;
+      read.UsnJournalID = to.journal_id;
+      bool done = false;
+      while (!done && read.StartUsn < to.usn)
+      {
+        DWORD bytes = 0;
+        if (!DeviceIoControl(m_volume, FSCTL_READ_USN_JOURNAL, &read, sizeof(read),
+                             buffer.data(), static_cast<DWORD>(buffer.size() * sizeof(std::uint64_t)), &bytes, nullptr))
+          return false;
+        if (bytes <= sizeof(USN))
+          break;
+        const std::uint8_t* data = reinterpret_cast<const std::uint8_t*>(buffer.data());
+        for (DWORD offset = sizeof(USN); offset < bytes;)
+        {
+          const USN_RECORD_V2* r = reinterpret_cast<const USN_RECORD_V2*>(data + offset);
+          if (r->MajorVersion != 2)
+            return false;
+          if (r->Usn >= to.usn)
+          {
+            done = true;
+            break;
+          }
+          const bool dir = (r->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+          const std::wstring name(reinterpret_cast<const wchar_t*>(reinterpret_cast<const std::uint8_t*>(r) + r->FileNameOffset),
+                                  r->FileNameLength / sizeof(wchar_t));
+          records.push_back({ r->ParentFileReferenceNumber, name, r->Reason, dir });
+          if (dir)
+            m_dirs[r->FileReferenceNumber] = { r->ParentFileReferenceNumber, name };
+          offset += r->RecordLength;
+        }
+        read.StartUsn = *reinterpret_cast<const USN*>(data);
+      }
+
+      // name of the changes relative to the tree
+      const std::wstring prefix = m_final_root + L'\\';
+      for (const auto& r : records)
+      {
+        const std::optional<std::wstring>& parent = resolve(r.parent);
+        if (!parent)
+          continue;
+        const std::wstring& name = *parent + L'\\' + r.name;
+        if (name.compare(0, prefix.size(), prefix) != 0)
+          continue;
+        const std::string& path = (m_root / name.substr(prefix.size())).u8string();
+        if (!r.dir)
+          result.files.insert(path);
+        else if (r.reason & (USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME | USN_REASON_RENAME_NEW_NAME))
+          result.dirs.insert(path);
+      }
+      return true;
+    }
+
+  private:
+    // name of an opened file: \\?\C:\dir\file
+    static std::wstring final_path(const HANDLE handle)
+    {
+      std::wstring name(MAX_PATH, L'\0');
+      DWORD len = GetFinalPathNameByHandleW(handle, name.data(), static_cast<DWORD>(name.size()), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+      if (len >= name.size())
+      {
+        name.resize(len);
+        len = GetFinalPathNameByHandleW(handle, name.data(), static_cast<DWORD>(name.size()), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+      }
+      name.resize(len < name.size() ? len : 0);
+      return name;
+    }
+
+    // current name of a directory - or its last name in the journal if it has been deleted
+    std::optional<std::wstring> resolve(const std::uint64_t frn, const int depth = 0)
+    {
+      const auto it = m_names.find(frn);
+      if (it != m_names.end())
+        return it->second;
+
+      std::optional<std::wstring> name;
+      FILE_ID_DESCRIPTOR id = {};
+      id.dwSize = sizeof(id);
+      id.Type = FileIdType;
+      id.FileId.QuadPart = static_cast<LONGLONG>(frn);
+      const HANDLE handle = OpenFileById(m_volume, &id, FILE_READ_ATTRIBUTES,
+                                         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                         FILE_FLAG_BACKUP_SEMANTICS);
+      if (handle != INVALID_HANDLE_VALUE)
+      {
+        const std::wstring& path = final_path(handle);
+        CloseHandle(handle);
+        if (!path.empty())
+          name = path;
+      }
+      else
+      {
+        const auto dir = m_dirs.find(frn);
+        if (dir != m_dirs.end() && depth < 256)
+        {
+          const std::optional<std::wstring>& parent = resolve(dir->second.first, depth + 1);
+          if (parent)
+            name = *parent + L'\\' + dir->second.second;
+        }
+      }
+      m_names[frn] = name;
+      return name;
+    }
+
+    const std::filesystem::path m_root;
+    HANDLE m_volume = INVALID_HANDLE_VALUE;
+    std::wstring m_final_root;
+    std::int64_t m_lowest = 0;
+    std::map<std::uint64_t, std::pair<std::uint64_t, std::wstring>> m_dirs;
+    std::map<std::uint64_t, std::optional<std::wstring>> m_names;
+  };
+
+  // position saved next to the database
+  inline std::filesystem::path state_path(const std::filesystem::path& db)
+  {
+    return std::filesystem::path(db) += ".usn";
+  }
+
+  inline bool load(const std::filesystem::path& path, position& pos)
+  {
+    std::ifstream file(path);
+    return static_cast<bool>(file >> pos.journal_id >> pos.usn);
+  }
+
+  inline void save(const std::filesystem::path& path, const position& pos)
+  {
+    std::ofstream file(path, std::ios::trunc);
+    file << pos.journal_id << " " << pos.usn << "\n";
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", path.filename().u8string()));
+  }
+
+  // read a list of changed files: one path per line or separated by '\0' ("-": standard input)
+  // - relative paths are relative to the root of the tree
+  inline changes read_list(const std::string& list, const std::filesystem::path& root)
+  {
+    std::string content;
+    if (list == "-")
+      content.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    else
+    {
+      std::ifstream file(std::filesystem::path(utf8::from_utf8(list)), std::ios::binary);
+      if (!file.good())
+        throw std::runtime_error(fmt::format("can't open file: \"{}\"", list));
+      content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    changes result;
+    const char separator = content.find('\0') != std::string::npos ? '\0' : '\n';
+    for (std::size_t pos = 0; pos < content.size();)
+    {
+      std::size_t end = content.find(separator, pos);
+      if (end == std::string::npos)
+        end = content.size();
+      std::string line = content.substr(pos, end - pos);
+      pos = end + 1;
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (line.empty())
+        continue;
+
+      // same spelling as the names of the database: root\relative\path
+      std::filesystem::path file = std::filesystem::path(utf8::from_utf8(line)).make_preferred();
+      if (file.is_relative())
+        file = root / file;
+      if (!file.has_filename() && file.has_relative_path())
+        file = file.parent_path();
+
+      // deleted path: a file or a directory (all its content) of the database
+      std::error_code ec;
+      const std::filesystem::file_status status = std::filesystem::status(file, ec);
+      if (!std::filesystem::exists(status))
+      {
+        result.files.insert(file.u8string());
+        result.dirs.insert(file.u8string());
+      }
+      else if (std::filesystem::is_directory(status))
+        result.dirs.insert(file.u8string());
+      else
+        result.files.insert(file.u8string());
+    }
+    return result;
+  }
+
+  // infos of an unchanged file taken from the database (with its archive members)
+  struct known_file {
+    file_infos infos;
+    std::vector<db_record> members;
+  };
+
+  // rebuild the sorted list of the files of a tree from its database and the changes since
+  // - known: infos of the unchanged files (empty: the file needs to be hashed)
+  inline void merge(const std::filesystem::path& root,
+                    const std::filesystem::path& db,
+                    const changes& changed,
+                    const bool archives,
+                    std::vector<std::filesystem::path>& files,
+                    std::vector<std::optional<known_file>>& known)
+  {
+    const std::string& prefix = (root / "x").u8string().substr(0, enumerate::prefix_length(root));
+    auto visible = [&](const std::filesystem::path& file) {
+      for (const auto& p : std::filesystem::relative(file, root).parent_path())
+        if (p.u8string().rfind(".", 0) == 0)
+          return false;
+      return true;
+    };
+    auto in_changed_dir = [&](const std::string& name) {
+      for (std::filesystem::path p = std::filesystem::path(utf8::from_utf8(name)).parent_path(); p.has_relative_path(); p = p.parent_path())
+        if (changed.dirs.count(p.u8string()))
+          return true;
+      return false;
+    };
+
+    // files to hash: the changed files still present and the content of the changed directories
+    std::set<std::string> rehash;
+    for (const auto& f : changed.files)
+    {
+      const std::filesystem::path& file = utf8::from_utf8(f);
+      std::error_code ec;
+      if (std::filesystem::is_regular_file(file, ec) && !std::filesystem::is_symlink(file, ec) && visible(file))
+        rehash.insert(f);
+    }
+    for (const auto& d : changed.dirs)
+    {
+      const std::filesystem::path& dir = utf8::from_utf8(d);
+      std::error_code ec;
+      if (std::filesystem::is_directory(dir, ec) && visible(dir / "x"))
+        for (const auto& f : enumerate::sorted_files(dir))
+          rehash.insert(f.u8string());
+    }
+
+    // unchanged files of the database
+    std::vector<std::pair<std::string, known_file>> kept;
+    std::map<std::string, std::size_t> owners;
+    read_database(db, [&](db_record&& r) {
+      if (r.first.compare(0, prefix.size(), prefix) != 0)
+        return;
+      if (archive::is_member(r.first))
+      {
+        // member of an unchanged archive
+        const auto owner = owners.find(r.first.substr(0, r.first.find(archive::separator)));
+        if (owner != owners.end())
+          kept[owner->second].second.members.push_back(std::move(r));
+        return;
+      }
+      if (changed.files.count(r.first) || in_changed_dir(r.first))
+        return;
+      if (archives && archive::get_kind(utf8::from_utf8(r.first)) != archive::kind::none)
+        owners.emplace(r.first, kept.size());
+      kept.push_back({ std::move(r.first), { std::move(r.second), {} } });
+      });
+    if (!std::is_sorted(kept.begin(), kept.end(), [](const auto& a, const auto& b) { return a.first < b.first; }))
+      std::sort(kept.begin(), kept.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    // merge both sorted lists
+    files.clear();
+    known.clear();
+    files.reserve(kept.size() + rehash.size());
+    known.reserve(kept.size() + rehash.size());
+    auto it = rehash.cbegin();
+    for (auto& [name, infos] : kept)
+    {
+      for (; it != rehash.cend() && *it <= name; ++it)
+      {
+        files.push_back(utf8::from_utf8(*it));
+        known.emplace_back();
+      }
+      if (!files.empty() && files.back().u8string() == name)
+        continue;
+      files.push_back(utf8::from_utf8(name));
+      known.emplace_back(std::move(infos));
+    }
+    for (; it != rehash.cend(); ++it)
+    {
+      files.push_back(utf8::from_utf8(*it));
+      known.emplace_back();
+    }
+  }
+}
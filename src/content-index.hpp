@@ -0,0 +1,296 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <cctype>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/progress-bar.hpp>
+#include "database.hpp"
+#include "cpu-limits.hpp"
+#include "mapped-file.hpp"
+#include "radix-sort.hpp"
+
+// global content index built from many databases (mmap-able binary file)
+//
+// file layout (little-endian, sections aligned on 64 bytes):
+//   header | databases [nb_databases] | paths [nb_paths] | bloom [nb_blocks] | entries [nb_entries] | strings
+// - entries are sorted by digest and map each digest to a database id and a path id
+// - a blocked bloom filter (one 512 bits block per digest) rejects unknown digests
+//   with a single cache-line access before the binary search
+namespace content_index {
+
+  constexpr char magic[8] = { 'M', 'F', 'C', 'I', 'D', 'X', '0', '1' };
+
+  // bloom filter parameters
+  constexpr std::size_t block_bytes = 64;
+  constexpr std::size_t bits_per_entry = 10;
+  constexpr std::size_t nb_probes = 6;
+
+  struct header {
+    char magic[8];
+    std::uint64_t nb_databases;
+    std::uint64_t nb_paths;
+    std::uint64_t nb_blocks;
+    std::uint64_t nb_entries;
+    std::uint64_t databases_offset;
+    std::uint64_t paths_offset;
+    std::uint64_t bloom_offset;
+    std::uint64_t entries_offset;
+    std::uint64_t strings_offset;
+    std::uint64_t strings_size;
+  };
+
+  // reference to a string of the strings section
+  struct string_ref {
+    std::uint64_t offset;
+    std::uint32_t length;
+    std::uint32_t id;
+  };
+
+  struct entry {
+    std::uint8_t digest[32];
+    std::uint32_t db_id;
+    std::uint32_t path_id;
+  };
+
+  // one file found in the index
+  struct match {
+    std::string database;
+    std::string path;
+  };
+
+  inline std::uint64_t align(const std::uint64_t v)
+  {
+    return (v + block_bytes - 1) / block_bytes * block_bytes;
+  }
+
+  // digests are uniformly distributed: their bytes are used directly as hash
+  inline std::uint64_t block_offset(const std::uint64_t nb_blocks, const std::uint8_t* d)
+  {
+    std::uint64_t h;
+    std::memcpy(&h, d, sizeof(h));
+    return (h % nb_blocks) * block_bytes;
+  }
+
+  inline void bloom_add(std::uint8_t* bloom, const std::uint64_t nb_blocks, const std::uint8_t* d)
+  {
+    std::uint8_t* block = bloom + block_offset(nb_blocks, d);
+    std::uint64_t h;
+    std::memcpy(&h, d + 8, sizeof(h));
+    for (std::size_t k = 0; k < nb_probes; ++k, h >>= 9)
+      block[(h & 511) >> 3] |= static_cast<std::uint8_t>(1 << (h & 7));
+  }
+
+  inline bool bloom_test(const std::uint8_t* bloom, const std::uint64_t nb_blocks, const std::uint8_t* d)
+  {
+    const std::uint8_t* block = bloom + block_offset(nb_blocks, d);
+    std::uint64_t h;
+    std::memcpy(&h, d + 8, sizeof(h));
+    for (std::size_t k = 0; k < nb_probes; ++k, h >>= 9)
+      if (!(block[(h & 511) >> 3] & (1 << (h & 7))))
+        return false;
+    return true;
+  }
+
+  // find all the databases (json files) of a directory
+  // - skipped: the other json files (configuration, manifests...)
+  inline std::vector<std::filesystem::path> find_databases(const std::filesystem::path& dir,
+                                                           std::vector<std::filesystem::path>& skipped)
+  {
+    std::vector<std::filesystem::path> dbs;
+    for (const auto& e : std::filesystem::recursive_directory_iterator(dir))
+    {
+      std::string ext = e.path().extension().u8string();
+      std::transform(ext.begin(), ext.end(), ext.begin(), [](const char c) { return static_cast<char>(std::tolower(c)); });
+      if (e.is_regular_file() && ext == ".json")
+        (is_database(e.path()) ? dbs : skipped).push_back(e.path());
+    }
+    std::sort(dbs.begin(), dbs.end());
+    std::sort(skipped.begin(), skipped.end());
+    return dbs;
+  }
+
+  // build the content index of all the databases
+  // - errors: the databases which can't be loaded (truncated...) are indexed without files
+  inline void build(const std::vector<std::filesystem::path>& dbs,
+                    const std::filesystem::path& index,
+                    std::vector<std::string>& errors,
+                    console::progress_bar& progress_bar)
+  {
+    // load databases in parallel - keep only names and digests
+    struct loaded_db {
+      std::vector<std::string> names;
+      std::vector<digest> digests;
+    };
+    std::vector<loaded_db> loaded(dbs.size());
+    std::atomic<std::size_t> next = 0;
+    std::mutex mutex;
+    const std::size_t nb_threads = std::min<std::size_t>(dbs.size(), cpu_limits::available());
+    std::vector<std::thread> threads(nb_threads);
+    for (auto& t : threads)
+      t = std::thread([&]() {
+        for (std::size_t i = next++; i < dbs.size(); i = next++)
+        {
+          try
+          {
+            for (const auto& [name, infos] : load_database(dbs[i]))
+            {
+              digest d;
+              if (!to_digest(infos.sha, d))
+                continue;
+              loaded[i].names.push_back(name);
+              loaded[i].digests.push_back(d);
+            }
+          }
+          catch (const std::exception& ex)
+          {
+            loaded[i] = loaded_db();
+            std::lock_guard<std::mutex> lock(mutex);
+            errors.push_back(fmt::format("\"{}\": {}", dbs[i].u8string(), ex.what()));
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          progress_bar.tick();
+        }
+      });
+    for (auto& t : threads)
+      if (t.joinable())
+        t.join();
+    std::sort(errors.begin(), errors.end());
+
+    // assign ids and collect all strings
+    header hdr = {};
+    std::memcpy(hdr.magic, magic, sizeof(magic));
+    std::vector<string_ref> db_refs;
+    std::vector<string_ref> path_refs;
+    std::vector<entry> entries;
+    std::string strings;
+    for (std::size_t i = 0; i < loaded.size(); ++i)
+    {
+      const std::string& db_name = dbs[i].u8string();
+      db_refs.push_back({ strings.size(), static_cast<std::uint32_t>(db_name.size()), static_cast<std::uint32_t>(i) });
+      strings += db_name;
+      for (std::size_t j = 0; j < loaded[i].names.size(); ++j)
+      {
+        const std::string& name = loaded[i].names[j];
+        if (path_refs.size() >= UINT32_MAX)
+          throw std::runtime_error("too many files for the content index");
+        entry e;
+        std::memcpy(e.digest, loaded[i].digests[j].data(), sizeof(e.digest));
+        e.db_id = static_cast<std::uint32_t>(i);
+        e.path_id = static_cast<std::uint32_t>(path_refs.size());
+        entries.push_back(e);
+        path_refs.push_back({ strings.size(), static_cast<std::uint32_t>(name.size()), static_cast<std::uint32_t>(i) });
+        strings += name;
+      }
+      loaded[i] = loaded_db();
+    }
+
+    // sort entries by digest - stable: entries are already in database/path order
+    radix_sort::permute(entries, radix_sort::order(entries.size(), [&](const std::uint32_t i) {
+      return std::string_view(reinterpret_cast<const char*>(entries[i].digest), sizeof(entries[i].digest));
+      }));
+
+    // fill the bloom filter
+    hdr.nb_databases = db_refs.size();
+    hdr.nb_paths = path_refs.size();
+    hdr.nb_entries = entries.size();
+    hdr.nb_blocks = std::max<std::uint64_t>(1, (entries.size() * bits_per_entry + block_bytes * 8 - 1) / (block_bytes * 8));
+    std::vector<std::uint8_t> bloom(hdr.nb_blocks * block_bytes, 0);
+    for (const auto& e : entries)
+      bloom_add(bloom.data(), hdr.nb_blocks, e.digest);
+
+    // compute sections offsets
+    hdr.databases_offset = align(sizeof(header));
+    hdr.paths_offset = align(hdr.databases_offset + db_refs.size() * sizeof(string_ref));
+    hdr.bloom_offset = align(hdr.paths_offset + path_refs.size() * sizeof(string_ref));
+    hdr.entries_offset = align(hdr.bloom_offset + bloom.size());
+    hdr.strings_offset = align(hdr.entries_offset + entries.size() * sizeof(entry));
+    hdr.strings_size = strings.size();
+
+    // write the index
+    std::ofstream file(index, std::ios::binary);
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", index.filename().u8string()));
+    auto write_at = [&](const std::uint64_t offset, const void* data, const std::size_t size) {
+      static const char zeros[block_bytes] = {};
+      const std::uint64_t pos = static_cast<std::uint64_t>(file.tellp());
+      file.write(zeros, static_cast<std::streamsize>(offset - pos));
+      file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+    write_at(0, &hdr, sizeof(hdr));
+    write_at(hdr.databases_offset, db_refs.data(), db_refs.size() * sizeof(string_ref));
+    write_at(hdr.paths_offset, path_refs.data(), path_refs.size() * sizeof(string_ref));
+    write_at(hdr.bloom_offset, bloom.data(), bloom.size());
+    write_at(hdr.entries_offset, entries.data(), entries.size() * sizeof(entry));
+    write_at(hdr.strings_offset, strings.data(), strings.size());
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", index.filename().u8string()));
+  }
+
+  // content index opened with a memory mapping
+  class reader {
+  public:
+    explicit reader(const std::filesystem::path& index) :
+      m_file(index)
+    {
+      if (m_file.size() < sizeof(header))
+        throw std::runtime_error(fmt::format("invalid content index: \"{}\"", index.u8string()));
+      m_hdr = reinterpret_cast<const header*>(m_file.data());
+      if (std::memcmp(m_hdr->magic, magic, sizeof(magic)) != 0 ||
+          m_hdr->nb_blocks == 0 ||
+          m_hdr->databases_offset + m_hdr->nb_databases * sizeof(string_ref) > m_file.size() ||
+          m_hdr->paths_offset + m_hdr->nb_paths * sizeof(string_ref) > m_file.size() ||
+          m_hdr->bloom_offset + m_hdr->nb_blocks * block_bytes > m_file.size() ||
+          m_hdr->entries_offset + m_hdr->nb_entries * sizeof(entry) > m_file.size() ||
+          m_hdr->strings_offset + m_hdr->strings_size > m_file.size())
+        throw std::runtime_error(fmt::format("invalid content index: \"{}\"", index.u8string()));
+      m_databases = reinterpret_cast<const string_ref*>(m_file.data() + m_hdr->databases_offset);
+      m_paths = reinterpret_cast<const string_ref*>(m_file.data() + m_hdr->paths_offset);
+      m_bloom = m_file.data() + m_hdr->bloom_offset;
+      m_entries = reinterpret_cast<const entry*>(m_file.data() + m_hdr->entries_offset);
+      m_strings = reinterpret_cast<const char*>(m_file.data() + m_hdr->strings_offset);
+    }
+
+    // find all the files having this digest
+    std::vector<match> find(const digest& d) const
+    {
+      std::vector<match> matches;
+      if (!bloom_test(m_bloom, m_hdr->nb_blocks, d.data()))
+        return matches;
+
+      const entry* end = m_entries + m_hdr->nb_entries;
+      const entry* it = std::lower_bound(m_entries, end, d, [](const entry& e, const digest& v) {
+        return std::memcmp(e.digest, v.data(), v.size()) < 0;
+        });
+      for (; it != end && std::memcmp(it->digest, d.data(), d.size()) == 0; ++it)
+        matches.push_back({ get_string(m_databases, m_hdr->nb_databases, it->db_id),
+                            get_string(m_paths, m_hdr->nb_paths, it->path_id) });
+      return matches;
+    }
+
+  private:
+    std::string get_string(const string_ref* refs, const std::uint64_t count, const std::uint32_t id) const
+    {
+      if (id >= count || refs[id].offset + refs[id].length > m_hdr->strings_size)
+        throw std::runtime_error("corrupted content index");
+      return std::string(m_strings + refs[id].offset, refs[id].length);
+    }
+
+    mapped_file m_file;
+    const header* m_hdr = nullptr;
+    const string_ref* m_databases = nullptr;
+    const string_ref* m_paths = nullptr;
+    const std::uint8_t* m_bloom = nullptr;
+    const entry* m_entries = nullptr;
+    const char* m_strings = nullptr;
+  };
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/files.hpp>
+#include <winpp/win.hpp>
+#include "file-infos.hpp"
+#include "sha256.hpp"
+
+// copy of files hashed during the copy: the data of each file is read only once
+// - each chunk read from the source is hashed and written to the destination
+// - the destination can be verified by reading it again without the system cache
+namespace copy_tree {
+
+  // size of the read/write chunks (multiple of the sector size for unbuffered reads)
+  constexpr DWORD chunk_size = 1024 * 1024;
+
+  // owned win32 file handle
+  class file_handle {
+  public:
+    file_handle(const std::filesystem::path& path,
+                const DWORD access,
+                const DWORD creation,
+                const DWORD flags)
+    {
+      m_handle = CreateFileW(path.wstring().c_str(), access, FILE_SHARE_READ, nullptr, creation, flags, nullptr);
+      if (m_handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.u8string()));
+    }
+
+    ~file_handle()
+    {
+      CloseHandle(m_handle);
+    }
+    file_handle(const file_handle&) = delete;
+    file_handle& operator=(const file_handle&) = delete;
+
+    HANDLE get() const { return m_handle; }
+
+  private:
+    HANDLE m_handle;
+  };
+
+  // chunk buffer aligned on pages (needed by unbuffered reads)
+  class aligned_buffer {
+  public:
+    aligned_buffer() :
+      m_data(static_cast<std::uint8_t*>(VirtualAlloc(nullptr, chunk_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE)))
+    {
+      if (!m_data)
+        throw std::runtime_error("can't allocate copy buffer");
+    }
+
+    ~aligned_buffer()
+    {
+      VirtualFree(m_data, 0, MEM_RELEASE);
+    }
+    aligned_buffer(const aligned_buffer&) = delete;
+    aligned_buffer& operator=(const aligned_buffer&) = delete;
+
+    std::uint8_t* data() const { return m_data; }
+
+  private:
+    std::uint8_t* m_data;
+  };
+
+  // copy one file and retrieve its infos - the timestamps of the source are kept
+  inline file_infos copy_file(const std::filesystem::path& src,
+                              const std::filesystem::path& dst,
+                              aligned_buffer& buffer)
+  {
+    const struct stat& src_info = files::get_stat(src);
+    sha256 hash;
+    std::uint64_t size = 0;
+    {
+      const file_handle in(src, GENERIC_READ, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN);
+      const file_handle out(dst, GENERIC_WRITE, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN);
+      while (true)
+      {
+        DWORD read = 0;
+        if (!ReadFile(in.get(), buffer.data(), chunk_size, &read, nullptr))
+          throw std::runtime_error(fmt::format("can't read file: \"{}\"", src.u8string()));
+        if (read == 0)
+          break;
+        hash.update(buffer.data(), read);
+        DWORD written = 0;
+        if (!WriteFile(out.get(), buffer.data(), read, &written, nullptr) || written != read)
+          throw std::runtime_error(fmt::format("can't write file: \"{}\"", dst.u8string()));
+        size += read;
+      }
+    }
+
+    // keep the timestamps of the source
+    const file_infos infos = {
+      hash.hex(),
+      static_cast<uint64_t>(src_info.st_ctime),
+      static_cast<uint64_t>(src_info.st_mtime),
+      size
+    };
+    if (!files::set_stat(dst, infos.ctime, 0, infos.mtime))
+      throw std::runtime_error(fmt::format("can't set the timestamps of file: \"{}\"", dst.u8string()));
+    return infos;
+  }
+
+  // read a file again without the system cache and check its hash
+  inline void verify(const std::filesystem::path& file,
+                     const std::string& sha,
+                     aligned_buffer& buffer)
+  {
+    sha256 hash;
+    {
+      const file_handle in(file, GENERIC_READ, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN);
+      while (true)
+      {
+        DWORD read = 0;
+        if (!ReadFile(in.get(), buffer.data(), chunk_size, &read, nullptr))
+          throw std::runtime_error(fmt::format("can't read file: \"{}\"", file.u8string()));
+        if (read == 0)
+          break;
+        hash.update(buffer.data(), read);
+      }
+    }
+    if (hash.hex() != sha)
+      throw std::runtime_error(fmt::format("verification failed for file: \"{}\"", file.u8string()));
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <fmt/core.h>
+#include <winpp/win.hpp>
+
+// number of threads really available to the process
+// - hardware_concurrency() reports the processors of the host, not the ones the process
+//   may use: a container (job object) or an affinity mask can restrict them
+// - the smallest of the active processors, the affinity mask and the cpu rate cap of
+//   the job object is used
+namespace cpu_limits {
+
+  struct sizing {
+    std::size_t threads = 1;
+    std::string reason;
+  };
+
+  // number of bits set in a mask
+  inline std::size_t count_bits(DWORD_PTR mask)
+  {
+    std::size_t n = 0;
+    for (; mask; mask &= mask - 1)
+      ++n;
+    return n;
+  }
+
+  inline sizing detect()
+  {
+    sizing s;
+    const DWORD active = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    s.threads = active > 0 ? active : std::max(1u, std::thread::hardware_concurrency());
+    s.reason = fmt::format("{} active processor(s)", s.threads);
+
+    // affinity mask of the process (only meaningful inside one processor group)
+    DWORD_PTR process_mask = 0, system_mask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) && process_mask != 0)
+    {
+      const std::size_t n = count_bits(process_mask);
+      if (n < s.threads)
+      {
+        s.threads = n;
+        s.reason = fmt::format("affinity mask of {} processor(s)", n);
+      }
+    }
+
+    // cpu rate cap of the job object (containers): 1/100 of percent of all the processors
+    BOOL in_job = FALSE;
+    JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate = {};
+    if (IsProcessInJob(GetCurrentProcess(), nullptr, &in_job) && in_job &&
+        QueryInformationJobObject(nullptr, JobObjectCpuRateControlInformation, &rate, sizeof(rate), nullptr) &&
+        (rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_ENABLE) &&
+        !(rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_WEIGHT_BASED))
+    {
+      const DWORD cap = (rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_MIN_MAX_RATE) ? rate.MaxRate : rate.CpuRate;
+      if (cap > 0 && cap < 10000)
+      {
+        const std::size_t n = std::max<std::size_t>(1, (static_cast<std::size_t>(active) * cap + 9999) / 10000);
+        if (n < s.threads)
+        {
+          s.threads = n;
+          s.reason = fmt::format("cpu rate of the job object capped at {}.{:02}%", cap / 100, cap % 100);
+        }
+      }
+    }
+    return s;
+  }
+
+  // sizing of the process (detected once)
+  inline const sizing& get()
+  {
+    static const sizing s = detect();
+    return s;
+  }
+
+  // number of threads to use for cpu-bound work
+  inline std::size_t available()
+  {
+    return get().threads;
+  }
+}
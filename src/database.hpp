@@ -0,0 +1,294 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <utility>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include "file-infos.hpp"
+
+// one entry of the database: file name (utf-8) and its infos
+using db_record = std::pair<std::string, struct file_infos>;
+
+// binary sha256 digest
+using digest = std::array<std::uint8_t, 32>;
+
+// convert a sha256 hexadecimal string to a binary digest
+inline bool to_digest(const std::string& hex, digest& d)
+{
+  if (hex.size() != d.size() * 2)
+    return false;
+  auto nibble = [](const char c) -> int {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+  for (std::size_t i = 0; i < d.size(); ++i)
+  {
+    const int hi = nibble(hex[2 * i]);
+    const int lo = nibble(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    d[i] = static_cast<std::uint8_t>((hi << 4) | lo);
+  }
+  return true;
+}
+
+// convert a binary digest to a sha256 hexadecimal string
+inline std::string to_hex(const std::uint8_t* d, const std::size_t len = std::tuple_size<digest>::value)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string hex(len * 2, '0');
+  for (std::size_t i = 0; i < len; ++i)
+  {
+    hex[2 * i] = digits[d[i] >> 4];
+    hex[2 * i + 1] = digits[d[i] & 0x0F];
+  }
+  return hex;
+}
+
+// compare two hashes - hexadecimal digests are compared whatever their case
+inline bool same_hash(const std::string& a, const std::string& b)
+{
+  digest da, db;
+  if (to_digest(a, da) && to_digest(b, db))
+    return da == db;
+  return a == b;
+}
+
+// sax handler of a database: hands each valid entry of "files" to a visitor
+// - only the current entry is kept in memory
+template<typename Visitor>
+class database_sax : public nlohmann::json_sax<nlohmann::json> {
+public:
+  explicit database_sax(Visitor& visit) :
+    m_visit(visit)
+  {
+  }
+
+  bool null() override { return value(); }
+  bool boolean(bool) override { return value(); }
+  bool number_integer(number_integer_t v) override { return number(v >= 0 ? static_cast<std::uint64_t>(v) : 0); }
+  bool number_unsigned(number_unsigned_t v) override { return number(v); }
+  bool number_float(number_float_t v, const string_t&) override { return number(v >= 0 ? static_cast<std::uint64_t>(v) : 0); }
+  bool binary(binary_t&) override { return value(); }
+
+  bool string(string_t& v) override
+  {
+    if (in_entry())
+    {
+      if (m_key == "name")
+        m_name = std::move(v), m_fields |= field_name;
+      else if (m_key == "sha")
+        m_infos.sha = std::move(v), m_fields |= field_sha;
+      else if (m_key == "midstate")
+        m_infos.midstate = std::move(v);
+    }
+    return value();
+  }
+
+  bool start_object(std::size_t) override
+  {
+    ++m_depth;
+    if (m_depth == 3 && m_in_files)
+    {
+      m_name.clear();
+      m_infos = file_infos();
+      m_fields = 0;
+    }
+    return true;
+  }
+
+  bool key(string_t& k) override
+  {
+    if (m_depth == 1)
+      m_files_key = (k == "files");
+    m_key = k;
+    return true;
+  }
+
+  bool end_object() override
+  {
+    // entry complete: check its validity - size is optional (older databases)
+    if (m_depth == 3 && m_in_files && (m_fields & field_required) == field_required)
+      m_visit(db_record(std::move(m_name), std::move(m_infos)));
+    --m_depth;
+    return value();
+  }
+
+  bool start_array(std::size_t) override
+  {
+    ++m_depth;
+    if (m_depth == 2 && m_files_key)
+      m_in_files = true;
+    return true;
+  }
+
+  bool end_array() override
+  {
+    if (m_depth == 2)
+      m_in_files = false;
+    --m_depth;
+    return value();
+  }
+
+  bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) override
+  {
+    throw std::runtime_error(fmt::format("invalid database: {}", ex.what()));
+  }
+
+private:
+  enum : unsigned {
+    field_name = 1,
+    field_sha = 2,
+    field_ctime = 4,
+    field_mtime = 8,
+    field_required = field_name | field_sha | field_ctime | field_mtime
+  };
+
+  bool in_entry() const
+  {
+    return m_depth == 3 && m_in_files;
+  }
+
+  bool number(const std::uint64_t v)
+  {
+    if (in_entry())
+    {
+      if (m_key == "ctime")
+        m_infos.ctime = v, m_fields |= field_ctime;
+      else if (m_key == "mtime")
+        m_infos.mtime = v, m_fields |= field_mtime;
+      else if (m_key == "size")
+        m_infos.size = v;
+    }
+    return value();
+  }
+
+  // a value of the root object other than "files" resets the key
+  bool value()
+  {
+    if (m_depth == 1)
+      m_files_key = false;
+    return true;
+  }
+
+  Visitor& m_visit;
+  std::size_t m_depth = 0;
+  bool m_files_key = false;
+  bool m_in_files = false;
+  std::string m_key;
+  std::string m_name;
+  file_infos m_infos;
+  unsigned m_fields = 0;
+};
+
+// read all the valid entries of a database (json file) one by one
+// - the file is parsed as a stream: memory doesn't depend on the database size
+template<typename Visitor>
+void read_database(const std::filesystem::path& path, Visitor visit)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file.good())
+    return;
+  database_sax<Visitor> sax(visit);
+  nlohmann::json::sax_parse(file, &sax);
+}
+
+// shape of a database: a json object with a "files" array - parsed up to this array
+class database_shape_sax : public nlohmann::json_sax<nlohmann::json> {
+public:
+  bool null() override { return value(); }
+  bool boolean(bool) override { return value(); }
+  bool number_integer(number_integer_t) override { return value(); }
+  bool number_unsigned(number_unsigned_t) override { return value(); }
+  bool number_float(number_float_t, const string_t&) override { return value(); }
+  bool string(string_t&) override { return value(); }
+  bool binary(binary_t&) override { return value(); }
+
+  bool start_object(std::size_t) override
+  {
+    ++m_depth;
+    return true;
+  }
+
+  bool key(string_t& k) override
+  {
+    if (m_depth == 1)
+      m_files_key = (k == "files");
+    return true;
+  }
+
+  bool end_object() override
+  {
+    --m_depth;
+    return value();
+  }
+
+  bool start_array(std::size_t) override
+  {
+    // found: stop the parse
+    if (m_depth == 1 && m_files_key)
+    {
+      m_found = true;
+      return false;
+    }
+    ++m_depth;
+    return m_depth > 1;
+  }
+
+  bool end_array() override
+  {
+    --m_depth;
+    return value();
+  }
+
+  bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override
+  {
+    return false;
+  }
+
+  bool found() const
+  {
+    return m_found;
+  }
+
+private:
+  // a value of the root object other than "files" resets the key - root not an object: stop
+  bool value()
+  {
+    if (m_depth == 1)
+      m_files_key = false;
+    return m_depth > 0;
+  }
+
+  std::size_t m_depth = 0;
+  bool m_files_key = false;
+  bool m_found = false;
+};
+
+// check that a json file has the shape of a database (other json files of a directory)
+inline bool is_database(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file.good())
+    return false;
+  database_shape_sax sax;
+  nlohmann::json::sax_parse(file, &sax);
+  return sax.found();
+}
+
+// load all the valid entries of a database (json file)
+inline std::vector<db_record> load_database(const std::filesystem::path& path)
+{
+  std::vector<db_record> records;
+  read_database(path, [&](db_record&& r) {
+    records.push_back(std::move(r));
+    });
+  return records;
+}
@@ -0,0 +1,286 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <fmt/core.h>
+#include "database.hpp"
+#include "mapped-file.hpp"
+#include "radix-sort.hpp"
+
+// binary index of one database (<database>.idx) used to query it without loading the json
+//
+// file layout (little-endian, sections aligned on 8 bytes):
+//   header | records [count] | hash order [count] | mtime order [count] | size order [count] | strings
+// - records are sorted by file name: exact path and prefix queries are binary searches
+// - the secondary indexes are permutations of the record ids sorted by digest/mtime/size
+namespace db_index {
+
+  constexpr char magic[8] = { 'M', 'F', 'D', 'B', 'I', 'D', 'X', '1' };
+
+  struct header {
+    char magic[8];
+    std::uint64_t count;
+    std::uint64_t records_offset;
+    std::uint64_t hash_order_offset;
+    std::uint64_t mtime_order_offset;
+    std::uint64_t size_order_offset;
+    std::uint64_t strings_offset;
+    std::uint64_t strings_size;
+  };
+
+  enum record_flags : std::uint32_t {
+    has_digest = 1
+  };
+
+  struct record {
+    std::uint64_t name_offset;
+    std::uint32_t name_length;
+    std::uint32_t flags;
+    std::uint64_t ctime;
+    std::uint64_t mtime;
+    std::uint64_t size;
+    std::uint8_t digest[32];
+  };
+
+  // criteria of a query - all the criteria set must match
+  struct query {
+    std::optional<std::string> path;
+    std::optional<std::string> prefix;
+    std::optional<digest> hash;
+    std::optional<std::pair<std::uint64_t, std::uint64_t>> size;
+    std::optional<std::pair<std::uint64_t, std::uint64_t>> mtime;
+  };
+
+  inline std::uint64_t align(const std::uint64_t v)
+  {
+    return (v + 7) & ~static_cast<std::uint64_t>(7);
+  }
+
+  // path of the index of a database
+  inline std::filesystem::path index_path(const std::filesystem::path& db)
+  {
+    std::filesystem::path p = db;
+    p += ".idx";
+    return p;
+  }
+
+  // check if the index of a database is missing or older than the database
+  inline bool is_outdated(const std::filesystem::path& db)
+  {
+    const std::filesystem::path& idx = index_path(db);
+    std::error_code ec;
+    const auto idx_time = std::filesystem::last_write_time(idx, ec);
+    return ec || idx_time < std::filesystem::last_write_time(db);
+  }
+
+  // write the index of database records sorted by name
+  template<typename Records>
+  void write(const Records& records, const std::filesystem::path& index)
+  {
+    if (records.size() > std::numeric_limits<std::uint32_t>::max())
+      throw std::runtime_error("too many files for the database index");
+
+    // build records and strings
+    std::vector<record> recs;
+    recs.reserve(records.size());
+    std::string strings;
+    for (const auto& [name, infos] : records)
+    {
+      record r = {};
+      r.name_offset = strings.size();
+      r.name_length = static_cast<std::uint32_t>(name.size());
+      r.ctime = infos.ctime;
+      r.mtime = infos.mtime;
+      r.size = infos.size;
+      digest d;
+      if (to_digest(infos.sha, d))
+      {
+        r.flags |= has_digest;
+        std::memcpy(r.digest, d.data(), d.size());
+      }
+      recs.push_back(r);
+      strings += name;
+    }
+
+    // build secondary indexes (parallel radix sorts)
+    const std::vector<std::uint32_t>& hash_order = radix_sort::order(recs.size(), [&](const std::uint32_t i) {
+      return std::string_view(reinterpret_cast<const char*>(recs[i].digest), sizeof(recs[i].digest));
+      });
+    const std::vector<std::uint32_t>& mtime_order = radix_sort::order_by_value(recs.size(), [&](const std::uint32_t i) {
+      return recs[i].mtime;
+      });
+    const std::vector<std::uint32_t>& size_order = radix_sort::order_by_value(recs.size(), [&](const std::uint32_t i) {
+      return recs[i].size;
+      });
+
+    // compute sections offsets
+    header hdr = {};
+    std::memcpy(hdr.magic, magic, sizeof(magic));
+    hdr.count = recs.size();
+    hdr.records_offset = align(sizeof(header));
+    hdr.hash_order_offset = align(hdr.records_offset + recs.size() * sizeof(record));
+    hdr.mtime_order_offset = align(hdr.hash_order_offset + recs.size() * sizeof(std::uint32_t));
+    hdr.size_order_offset = align(hdr.mtime_order_offset + recs.size() * sizeof(std::uint32_t));
+    hdr.strings_offset = align(hdr.size_order_offset + recs.size() * sizeof(std::uint32_t));
+    hdr.strings_size = strings.size();
+
+    // write the index
+    std::ofstream file(index, std::ios::binary);
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", index.filename().u8string()));
+    auto write_at = [&](const std::uint64_t offset, const void* data, const std::size_t size) {
+      static const char zeros[8] = {};
+      const std::uint64_t pos = static_cast<std::uint64_t>(file.tellp());
+      file.write(zeros, static_cast<std::streamsize>(offset - pos));
+      file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+    write_at(0, &hdr, sizeof(hdr));
+    write_at(hdr.records_offset, recs.data(), recs.size() * sizeof(record));
+    write_at(hdr.hash_order_offset, hash_order.data(), hash_order.size() * sizeof(std::uint32_t));
+    write_at(hdr.mtime_order_offset, mtime_order.data(), mtime_order.size() * sizeof(std::uint32_t));
+    write_at(hdr.size_order_offset, size_order.data(), size_order.size() * sizeof(std::uint32_t));
+    write_at(hdr.strings_offset, strings.data(), strings.size());
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", index.filename().u8string()));
+  }
+
+  // database index opened with a memory mapping
+  class reader {
+  public:
+    explicit reader(const std::filesystem::path& index) :
+      m_file(index)
+    {
+      if (m_file.size() < sizeof(header))
+        throw std::runtime_error(fmt::format("invalid database index: \"{}\"", index.u8string()));
+      m_hdr = reinterpret_cast<const header*>(m_file.data());
+      const std::uint64_t orders_size = m_hdr->count * sizeof(std::uint32_t);
+      if (std::memcmp(m_hdr->magic, magic, sizeof(magic)) != 0 ||
+          m_hdr->records_offset + m_hdr->count * sizeof(record) > m_file.size() ||
+          m_hdr->hash_order_offset + orders_size > m_file.size() ||
+          m_hdr->mtime_order_offset + orders_size > m_file.size() ||
+          m_hdr->size_order_offset + orders_size > m_file.size() ||
+          m_hdr->strings_offset + m_hdr->strings_size > m_file.size())
+        throw std::runtime_error(fmt::format("invalid database index: \"{}\"", index.u8string()));
+      m_records = reinterpret_cast<const record*>(m_file.data() + m_hdr->records_offset);
+      m_hash_order = reinterpret_cast<const std::uint32_t*>(m_file.data() + m_hdr->hash_order_offset);
+      m_mtime_order = reinterpret_cast<const std::uint32_t*>(m_file.data() + m_hdr->mtime_order_offset);
+      m_size_order = reinterpret_cast<const std::uint32_t*>(m_file.data() + m_hdr->size_order_offset);
+      m_strings = reinterpret_cast<const char*>(m_file.data() + m_hdr->strings_offset);
+    }
+
+    std::uint64_t size() const { return m_hdr->count; }
+
+    // visit all the records sorted by name without copying the names
+    template<typename Visit>
+    void for_each(Visit visit) const
+    {
+      for (std::uint64_t id = 0; id < m_hdr->count; ++id)
+        visit(name(m_records[id]), m_records[id]);
+    }
+
+    // find all the records matching the query
+    std::vector<db_record> find(const query& q) const
+    {
+      std::vector<db_record> results;
+      auto add = [&](const std::uint32_t id) {
+        if (matches(q, id))
+          results.emplace_back(std::string(name(id)), infos(id));
+      };
+
+      // use the most selective index available
+      const std::uint32_t count = static_cast<std::uint32_t>(m_hdr->count);
+      if (q.path || q.prefix)
+      {
+        const std::string_view key = q.path ? *q.path : *q.prefix;
+        const record* it = std::lower_bound(m_records, m_records + count, key, [&](const record& r, const std::string_view& k) {
+          return name(r) < k;
+          });
+        for (std::uint32_t id = static_cast<std::uint32_t>(it - m_records); id < count; ++id)
+        {
+          const std::string_view n = name(id);
+          if (q.path ? n != key : n.substr(0, key.size()) != key)
+            break;
+          add(id);
+        }
+      }
+      else if (q.hash)
+        scan_order(m_hash_order, count, [&](const record& r) {
+          return std::memcmp(r.digest, q.hash->data(), q.hash->size()) < 0;
+          }, [&](const record& r) {
+          return std::memcmp(r.digest, q.hash->data(), q.hash->size()) <= 0;
+          }, add);
+      else if (q.mtime)
+        scan_order(m_mtime_order, count,
+          [&](const record& r) { return r.mtime < q.mtime->first; },
+          [&](const record& r) { return r.mtime <= q.mtime->second; },
+          add);
+      else if (q.size)
+        scan_order(m_size_order, count,
+          [&](const record& r) { return r.size < q.size->first; },
+          [&](const record& r) { return r.size <= q.size->second; },
+          add);
+      else
+        for (std::uint32_t id = 0; id < count; ++id)
+          add(id);
+      return results;
+    }
+
+  private:
+    // visit the ids of a secondary index between the bounds (before: record is before the range, inside: record isn't after the range)
+    template<typename Before, typename Inside, typename Visit>
+    void scan_order(const std::uint32_t* order, const std::uint32_t count, Before before, Inside inside, Visit visit) const
+    {
+      const std::uint32_t* it = std::partition_point(order, order + count, [&](const std::uint32_t id) {
+        return before(m_records[id]);
+        });
+      for (; it != order + count && inside(m_records[*it]); ++it)
+        visit(*it);
+    }
+
+    bool matches(const query& q, const std::uint32_t id) const
+    {
+      const record& r = m_records[id];
+      if (q.path && name(r) != *q.path)
+        return false;
+      if (q.prefix && name(r).substr(0, q.prefix->size()) != *q.prefix)
+        return false;
+      if (q.hash && (!(r.flags & has_digest) || std::memcmp(r.digest, q.hash->data(), q.hash->size()) != 0))
+        return false;
+      if (q.mtime && (r.mtime < q.mtime->first || r.mtime > q.mtime->second))
+        return false;
+      if (q.size && (r.size < q.size->first || r.size > q.size->second))
+        return false;
+      return true;
+    }
+
+    std::string_view name(const record& r) const
+    {
+      if (r.name_offset + r.name_length > m_hdr->strings_size)
+        throw std::runtime_error("corrupted database index");
+      return std::string_view(m_strings + r.name_offset, r.name_length);
+    }
+    std::string_view name(const std::uint32_t id) const { return name(m_records[id]); }
+
+    file_infos infos(const std::uint32_t id) const
+    {
+      const record& r = m_records[id];
+      return { (r.flags & has_digest) ? to_hex(r.digest) : std::string(), r.ctime, r.mtime, r.size };
+    }
+
+    mapped_file m_file;
+    const header* m_hdr = nullptr;
+    const record* m_records = nullptr;
+    const std::uint32_t* m_hash_order = nullptr;
+    const std::uint32_t* m_mtime_order = nullptr;
+    const std::uint32_t* m_size_order = nullptr;
+    const char* m_strings = nullptr;
+  };
+}
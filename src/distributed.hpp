@@ -0,0 +1,490 @@
+#pragma once
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <string>
+#include <filesystem>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/progress-bar.hpp>
+#include <winpp/utf8.hpp>
+#include "file-infos.hpp"
+#include "process.hpp"
+#include "ordered-results.hpp"
+
+// distributed hashing: a coordinator process hands partitions of the tree
+// to local worker processes (mark-files --worker) over tcp sockets
+//
+// line-based protocol (utf-8):
+//   coordinator => worker: "F <index> <path>" one file of the partition
+//                          "E"                end of the partition
+//                          "Q"                no more work, quit
+//   worker => coordinator: "R <index> <sha> <ctime> <mtime> <size>" one result
+//                          "X <index> <message>" one file that can't be hashed
+//                          "D"                partition done
+namespace distributed {
+
+  // partition of files to hash (indexes in the list of files)
+  struct partition {
+    std::vector<std::size_t> files;
+    std::uint64_t bytes = 0;
+  };
+
+  // number of partitions per worker: gives room for work stealing
+  constexpr std::size_t partitions_per_worker = 8;
+
+  // maximum number of files in one partition
+  constexpr std::size_t max_partition_files = 4096;
+
+  // delay to wait for the workers to connect (seconds)
+  constexpr long connect_timeout = 30;
+
+  // winsock initialization - scoped
+  class winsock {
+  public:
+    winsock()
+    {
+      WSADATA data;
+      if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        throw std::runtime_error("can't initialize winsock");
+    }
+    ~winsock() { WSACleanup(); }
+    winsock(const winsock&) = delete;
+    winsock& operator=(const winsock&) = delete;
+  };
+
+  // tcp connection with line-based read/write
+  class connection {
+  public:
+    explicit connection(SOCKET s) : m_socket(s)
+    {
+      // disable nagle: protocol is made of small request/response messages
+      const BOOL nodelay = TRUE;
+      setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&nodelay), sizeof(nodelay));
+    }
+    ~connection() { close(); }
+    connection(const connection&) = delete;
+    connection& operator=(const connection&) = delete;
+
+    void close()
+    {
+      if (m_socket != INVALID_SOCKET)
+      {
+        shutdown(m_socket, SD_BOTH);
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+      }
+    }
+
+    // send a buffer entirely
+    void send_all(const std::string& data)
+    {
+      std::size_t sent = 0;
+      while (sent < data.size())
+      {
+        const int n = send(m_socket, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+        if (n == SOCKET_ERROR || n == 0)
+          throw std::runtime_error(fmt::format("socket send failed: {}", WSAGetLastError()));
+        sent += static_cast<std::size_t>(n);
+      }
+    }
+
+    // read one line (without '\n') - returns false on end of stream
+    bool read_line(std::string& line)
+    {
+      while (true)
+      {
+        const std::size_t pos = m_buffer.find('\n', m_offset);
+        if (pos != std::string::npos)
+        {
+          line.assign(m_buffer, m_offset, pos - m_offset);
+          m_offset = pos + 1;
+          return true;
+        }
+
+        // compact buffer before receiving more data
+        m_buffer.erase(0, m_offset);
+        m_offset = 0;
+        char buf[64 * 1024];
+        const int n = recv(m_socket, buf, sizeof(buf), 0);
+        if (n == 0)
+          return false;
+        if (n == SOCKET_ERROR)
+          throw std::runtime_error(fmt::format("socket receive failed: {}", WSAGetLastError()));
+        m_buffer.append(buf, static_cast<std::size_t>(n));
+      }
+    }
+
+  private:
+    SOCKET m_socket;
+    std::string m_buffer;
+    std::size_t m_offset = 0;
+  };
+
+  // split the files into partitions using the size of the sub-directories
+  // - sizes: given by the enumeration (no stat) - empty: partitions by number of files
+  // - files of one directory are kept together as long as the partition isn't too big
+  // - partitions are sorted by size (biggest first) to balance the workers
+  inline std::vector<partition> make_partitions(const std::vector<std::filesystem::path>& files,
+                                                const std::vector<std::uint64_t>& sizes,
+                                                const std::size_t nb_workers)
+  {
+    auto size = [&](const std::size_t i) -> std::uint64_t {
+      return sizes.empty() ? 1 : sizes[i];
+    };
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+      total += size(i);
+
+    // group files by parent directory
+    std::map<std::filesystem::path, std::vector<std::size_t>> dirs;
+    for (std::size_t i = 0; i < files.size(); ++i)
+      dirs[files[i].parent_path()].push_back(i);
+
+    // accumulate directories into partitions of target size
+    const std::uint64_t target = std::max<std::uint64_t>(1, total / std::max<std::size_t>(1, nb_workers * partitions_per_worker));
+    std::vector<partition> partitions;
+    partition current;
+    for (const auto& [dir, indexes] : dirs)
+    {
+      for (const auto& i : indexes)
+      {
+        current.files.push_back(i);
+        current.bytes += size(i);
+        if (current.bytes >= target || current.files.size() >= max_partition_files)
+        {
+          partitions.push_back(std::move(current));
+          current = partition();
+        }
+      }
+    }
+    if (!current.files.empty())
+      partitions.push_back(std::move(current));
+
+    std::sort(partitions.begin(), partitions.end(), [](const partition& a, const partition& b) {
+      return a.bytes > b.bytes;
+      });
+    return partitions;
+  }
+
+  // per-worker queues of partitions with work stealing
+  class scheduler {
+  public:
+    scheduler(std::vector<partition>&& partitions, const std::size_t nb_workers) :
+      m_queues(nb_workers)
+    {
+      // deal biggest partitions first in round-robin
+      for (std::size_t i = 0; i < partitions.size(); ++i)
+        push(i % nb_workers, std::move(partitions[i]));
+    }
+
+    // retrieve the next partition for one worker - steal from the most loaded one if empty
+    // - false once stopped
+    bool next(const std::size_t worker, partition& p)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_stopped)
+        return false;
+      if (!m_queues[worker].empty())
+      {
+        p = std::move(m_queues[worker].front());
+        m_queues[worker].pop_front();
+        return true;
+      }
+
+      std::size_t victim = m_queues.size();
+      std::uint64_t victim_bytes = 0;
+      for (std::size_t i = 0; i < m_queues.size(); ++i)
+      {
+        std::uint64_t bytes = 0;
+        for (const auto& q : m_queues[i])
+          bytes += q.bytes;
+        if (!m_queues[i].empty() && (victim == m_queues.size() || bytes > victim_bytes))
+        {
+          victim = i;
+          victim_bytes = bytes;
+        }
+      }
+      if (victim == m_queues.size())
+        return false;
+      p = std::move(m_queues[victim].back());
+      m_queues[victim].pop_back();
+      return true;
+    }
+
+    // give back a partition of a failed worker to the others
+    void push(const std::size_t worker, partition&& p)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queues[worker].push_back(std::move(p));
+    }
+
+    // stop handing out partitions (file error or consumer cancelled)
+    void stop()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopped = true;
+    }
+
+    bool stopped()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_stopped;
+    }
+
+    // check if some partitions are still waiting
+    bool empty()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (const auto& q : m_queues)
+        if (!q.empty())
+          return false;
+      return true;
+    }
+
+  private:
+    std::mutex m_mutex;
+    std::vector<std::deque<partition>> m_queues;
+    bool m_stopped = false;
+  };
+
+  // serve one connected worker until there is no more work
+  // - stopped (file error of any worker, consumer cancelled): returns at the next message without
+  //   waiting for the end of the partition, the coordinator kills the workers
+  inline void serve_worker(connection& conn,
+                           const std::size_t worker,
+                           scheduler& sched,
+                           const std::vector<std::filesystem::path>& files,
+                           std::mutex& mutex,
+                           ordered_results& results,
+                           console::progress_bar& progress_bar)
+  {
+    partition p;
+    while (sched.next(worker, p))
+    {
+      try
+      {
+        // send the whole partition at once
+        std::string request;
+        for (const auto& i : p.files)
+          request += fmt::format("F {} {}\n", i, files[i].u8string());
+        request += "E\n";
+        conn.send_all(request);
+
+        // retrieve the results streamed by the worker
+        std::string line;
+        while (true)
+        {
+          if (!conn.read_line(line))
+            throw std::runtime_error("worker disconnected");
+          if (line == "D")
+            break;
+          if (sched.stopped())
+            return;
+
+          // file that the worker couldn't hash: the scan fails as with threads, the
+          // partition isn't given back (the other workers would fail the same way)
+          std::size_t index;
+          int offset = 0;
+          if (line.size() > 2 && line[0] == 'X' &&
+              std::sscanf(line.c_str(), "X %zu %n", &index, &offset) == 1 && offset > 0 && index < files.size())
+          {
+            results.fail(std::make_exception_ptr(std::runtime_error(fmt::format("can't hash file: \"{}\": {}",
+              files[index].u8string(), line.substr(static_cast<std::size_t>(offset))))));
+            sched.stop();
+            return;
+          }
+
+          char sha[256];
+          unsigned long long ctime, mtime, size;
+          if (line.size() >= sizeof(sha) ||
+              std::sscanf(line.c_str(), "R %zu %255s %llu %llu %llu", &index, sha, &ctime, &mtime, &size) != 5 ||
+              index >= files.size())
+            throw std::runtime_error(fmt::format("invalid message from worker: \"{}\"", line));
+
+          // store the result in its slot and update progress_bar - protected by mutex
+          const bool inserted = results.store(index,
+            file_infos{ sha,
+                        static_cast<uint64_t>(ctime),
+                        static_cast<uint64_t>(mtime),
+                        static_cast<uint64_t>(size) });
+          if (!inserted)
+          {
+            // cancelled by the consumer
+            sched.stop();
+            return;
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          progress_bar.tick();
+        }
+      }
+      catch (const std::exception&)
+      {
+        // give the partition back to the other workers
+        sched.push(worker, std::move(p));
+        throw;
+      }
+    }
+    conn.send_all("Q\n");
+  }
+
+  // distribute the extraction of infos to local worker processes
+  inline void coordinate(const std::vector<std::filesystem::path>& files,
+                         const std::vector<std::uint64_t>& sizes,
+                         const std::size_t nb_workers,
+                         ordered_results& results,
+                         console::progress_bar& progress_bar)
+  {
+    winsock ws;
+
+    // listen on a random local port
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET)
+      throw std::runtime_error("can't create socket");
+    connection listener_guard(listener);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int addr_len = sizeof(addr);
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR ||
+        listen(listener, SOMAXCONN) == SOCKET_ERROR ||
+        getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addr_len) == SOCKET_ERROR)
+      throw std::runtime_error(fmt::format("can't listen on local socket: {}", WSAGetLastError()));
+    const std::string address = fmt::format("127.0.0.1:{}", ntohs(addr.sin_port));
+
+    // start the workers
+    std::vector<PROCESS_INFORMATION> processes;
+    std::exception_ptr error;
+    bool stopped = false;
+    try
+    {
+      for (std::size_t i = 0; i < nb_workers; ++i)
+        processes.push_back(process::spawn_self("--worker " + address));
+
+      // accept connections of all workers
+      std::vector<std::unique_ptr<connection>> conns;
+      while (conns.size() < nb_workers)
+      {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(listener, &fds);
+        timeval timeout = { connect_timeout, 0 };
+        if (select(0, &fds, nullptr, nullptr, &timeout) <= 0)
+          throw std::runtime_error("timeout while waiting for the workers");
+        const SOCKET s = accept(listener, nullptr, nullptr);
+        if (s == INVALID_SOCKET)
+          throw std::runtime_error(fmt::format("can't accept worker connection: {}", WSAGetLastError()));
+        conns.push_back(std::make_unique<connection>(s));
+      }
+
+      // serve each worker in its own thread
+      scheduler sched(make_partitions(files, sizes, nb_workers), nb_workers);
+      std::mutex mutex;
+      std::vector<std::exception_ptr> errors(nb_workers);
+      std::vector<std::thread> threads(nb_workers);
+      for (std::size_t i = 0; i < nb_workers; ++i)
+        threads[i] = std::thread([&, i]() {
+          try
+          {
+            serve_worker(*conns[i], i, sched, files, mutex, results, progress_bar);
+          }
+          catch (...)
+          {
+            errors[i] = std::current_exception();
+          }
+        });
+      for (auto& t : threads)
+        if (t.joinable())
+          t.join();
+      stopped = sched.stopped();
+
+      // failed workers have given back their partitions: only fail if nobody could process them
+      if (!sched.empty())
+        for (const auto& e : errors)
+          if (e)
+            std::rethrow_exception(e);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+
+    // stopped: the workers may still be hashing their partition
+    process::wait_all(processes, error != nullptr || stopped);
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  // run as a worker: hash the partitions sent by the coordinator
+  inline void run_worker(const std::string& address)
+  {
+    winsock ws;
+
+    // connect to the coordinator
+    const std::size_t sep = address.rfind(':');
+    if (sep == std::string::npos)
+      throw std::runtime_error(fmt::format("invalid coordinator address: \"{}\"", address));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<unsigned short>(std::stoul(address.substr(sep + 1))));
+    if (inet_pton(AF_INET, address.substr(0, sep).c_str(), &addr.sin_addr) != 1)
+      throw std::runtime_error(fmt::format("invalid coordinator address: \"{}\"", address));
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+      throw std::runtime_error("can't create socket");
+    connection conn(s);
+    if (connect(s, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR)
+      throw std::runtime_error(fmt::format("can't connect to coordinator: {}", WSAGetLastError()));
+
+    // process partitions until the coordinator stops
+    std::vector<std::pair<std::size_t, std::filesystem::path>> todo;
+    std::string line;
+    while (conn.read_line(line))
+    {
+      if (line == "Q")
+        break;
+      else if (line == "E")
+      {
+        // stream one result per file - or its error (unreadable, locked): the worker goes on
+        for (const auto& [index, file] : todo)
+        {
+          std::string reply;
+          try
+          {
+            const file_infos& infos = get_file_infos(file);
+            reply = fmt::format("R {} {} {} {} {}\n", index, infos.sha, infos.ctime, infos.mtime, infos.size);
+          }
+          catch (const std::exception& ex)
+          {
+            std::string message = ex.what();
+            std::replace(message.begin(), message.end(), '\n', ' ');
+            std::replace(message.begin(), message.end(), '\r', ' ');
+            reply = fmt::format("X {} {}\n", index, message);
+          }
+          conn.send_all(reply);
+        }
+        conn.send_all("D\n");
+        todo.clear();
+      }
+      else if (line.size() > 2 && line[0] == 'F')
+      {
+        const std::size_t pos = line.find(' ', 2);
+        if (pos == std::string::npos)
+          throw std::runtime_error(fmt::format("invalid message from coordinator: \"{}\"", line));
+        todo.emplace_back(std::stoull(line.substr(2, pos - 2)),
+                          std::filesystem::path(utf8::from_utf8(line.substr(pos + 1))));
+      }
+      else
+        throw std::runtime_error(fmt::format("invalid message from coordinator: \"{}\"", line));
+    }
+  }
+}
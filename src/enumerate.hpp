@@ -0,0 +1,177 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <cstdint>
+#include "cpu-limits.hpp"
+
+// parallel enumeration of a directory tree
+// - size and mtime come from the directory listing (no file is opened)
+// - directories starting with '.' are skipped (hidden)
+namespace enumerate {
+
+  // one file found in the tree
+  struct entry {
+    std::string name;
+    std::uint64_t size = 0;
+    std::uint64_t mtime = 0;
+  };
+
+  // seconds between 1601-01-01 (windows file time epoch) and 1970-01-01
+  constexpr std::int64_t filetime_to_unix = 11644473600LL;
+
+  // convert a file time to a unix timestamp (seconds)
+  inline std::uint64_t to_timestamp(const std::filesystem::file_time_type& t)
+  {
+    const std::int64_t s = std::chrono::duration_cast<std::chrono::seconds>(t.time_since_epoch()).count();
+    return static_cast<std::uint64_t>(s - filetime_to_unix);
+  }
+
+  // list all the files of a tree using multiple threads (unsorted)
+  inline std::vector<entry> files(const std::filesystem::path& root,
+                                  const std::size_t nb_threads = cpu_limits::available())
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::filesystem::path> dirs = { root };
+    std::size_t busy = 0;
+    std::exception_ptr error;
+    std::vector<std::vector<entry>> results(std::max<std::size_t>(1, nb_threads));
+
+    auto worker = [&](std::vector<entry>& found) {
+      while (true)
+      {
+        // retrieve one directory - stop when no directory is left and nobody can add more
+        std::filesystem::path dir;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]() { return !dirs.empty() || busy == 0 || error; });
+          if (dirs.empty() || error)
+            break;
+          dir = std::move(dirs.back());
+          dirs.pop_back();
+          ++busy;
+        }
+
+        // list the directory
+        std::vector<std::filesystem::path> subdirs;
+        try
+        {
+          for (const auto& e : std::filesystem::directory_iterator(dir))
+          {
+            if (e.is_directory() && !e.is_symlink())
+            {
+              if (e.path().filename().u8string().rfind(".", 0) != 0)
+                subdirs.push_back(e.path());
+            }
+            else if (e.is_regular_file())
+              found.push_back({ e.path().u8string(),
+                                static_cast<std::uint64_t>(e.file_size()),
+                                to_timestamp(e.last_write_time()) });
+          }
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error)
+            error = std::current_exception();
+        }
+
+        // publish the sub-directories
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          for (auto& d : subdirs)
+            dirs.push_back(std::move(d));
+          --busy;
+        }
+        cv.notify_all();
+      }
+      cv.notify_all();
+    };
+
+    std::vector<std::thread> threads;
+    for (auto& r : results)
+      threads.emplace_back(worker, std::ref(r));
+    for (auto& t : threads)
+      if (t.joinable())
+        t.join();
+    if (error)
+      std::rethrow_exception(error);
+
+    // concatenate the results of all threads
+    std::vector<entry> all;
+    for (auto& r : results)
+    {
+      all.insert(all.end(), std::make_move_iterator(r.begin()), std::make_move_iterator(r.end()));
+      r = std::vector<entry>();
+    }
+    return all;
+  }
+
+  // visit the files of a directory in the order of their full path (depth-first)
+  template<typename Visit>
+  void sorted_walk(const std::filesystem::path& dir, Visit& visit)
+  {
+    // sort key: name, followed by '\' for directories (separator of their content)
+    std::vector<std::pair<std::string, std::filesystem::directory_entry>> children;
+    for (const auto& e : std::filesystem::directory_iterator(dir))
+    {
+      const std::string& name = e.path().filename().u8string();
+      if (e.is_directory() && !e.is_symlink())
+      {
+        if (name.rfind(".", 0) != 0)
+          children.emplace_back(name + '\\', e);
+      }
+      else if (e.is_regular_file())
+        children.emplace_back(name, e);
+    }
+    std::sort(children.begin(), children.end(), [](const auto& a, const auto& b) {
+      return a.first < b.first;
+      });
+    for (const auto& [key, e] : children)
+    {
+      if (key.back() == '\\')
+        sorted_walk(e.path(), visit);
+      else
+        visit(e);
+    }
+  }
+
+  // list all the files of a tree sorted by full path (utf-8 byte order)
+  // - each directory is sorted on its own: no global sort of the tree
+  inline std::vector<std::filesystem::path> sorted_files(const std::filesystem::path& root)
+  {
+    std::vector<std::filesystem::path> files;
+    auto visit = [&](const std::filesystem::directory_entry& e) {
+      files.push_back(e.path());
+    };
+    sorted_walk(root, visit);
+    return files;
+  }
+
+  // list all the files of a tree with their size and mtime sorted by full path
+  inline std::vector<entry> sorted_entries(const std::filesystem::path& root)
+  {
+    std::vector<entry> entries;
+    auto visit = [&](const std::filesystem::directory_entry& e) {
+      entries.push_back({ e.path().u8string(),
+                          static_cast<std::uint64_t>(e.file_size()),
+                          to_timestamp(e.last_write_time()) });
+    };
+    sorted_walk(root, visit);
+    return entries;
+  }
+
+  // length of the prefix of the root in the names of its files
+  inline std::size_t prefix_length(const std::filesystem::path& root)
+  {
+    return (root / "x").u8string().size() - 1;
+  }
+}
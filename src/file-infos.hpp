@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <filesystem>
+#include <winpp/files.hpp>
+
+// file information that will be extracted/computed
+struct file_infos {
+  std::string sha;
+  std::uint64_t ctime = 0;
+  std::uint64_t mtime = 0;
+  std::uint64_t size = 0;
+  std::string midstate;   // resumable hash state (optional)
+};
+
+// retrieve infos for one file
+inline file_infos get_file_infos(const std::filesystem::path& file)
+{
+  const struct stat& file_info = files::get_stat(file);
+  const std::string& file_hash = files::get_hash(file);
+
+  // st_size is only 32 bits with msvc
+  return {
+    file_hash,
+    static_cast<uint64_t>(file_info.st_ctime),
+    static_cast<uint64_t>(file_info.st_mtime),
+    static_cast<uint64_t>(std::filesystem::file_size(file))
+  };
+}
@@ -0,0 +1,368 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <ctime>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include "database.hpp"
+
+// history of the runs: one base snapshot followed by per-run deltas
+//
+// file layout: magic | block | block | ...
+//   block: u64 size | u8 kind | varint run | varint date | varint count | records
+//   record: u8 op | varint shared prefix | varint suffix length | suffix | [infos]
+//   infos:  digest (32 bytes) or varint length + sha | zigzag varint delta of ctime/mtime | varint size
+// - records are sorted by name: names are front-coded against the previous record
+// - timestamps are delta-encoded against the previous record of the block
+// - a new base is written when the deltas since the last base outgrow half of it,
+//   so the storage grows with the churn and a state is rebuilt from one base + few deltas
+// - an incomplete trailing block (interrupted append) is ignored and overwritten by the next append
+namespace history {
+
+  constexpr char magic[8] = { 'M', 'F', 'H', 'I', 'S', 'T', '0', '1' };
+
+  enum block_kind : std::uint8_t {
+    base = 0,
+    delta = 1
+  };
+
+  enum record_op : std::uint8_t {
+    upsert = 0,
+    remove = 1,
+    raw_sha = 0x80
+  };
+
+  // summary of one run of the history
+  struct run_info {
+    std::uint64_t run = 0;
+    std::uint64_t date = 0;
+    std::uint64_t count = 0;
+    block_kind kind = base;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+  };
+
+  // state of the files as of one run
+  using state = std::map<std::string, struct file_infos>;
+
+  inline void put_varint(std::string& out, std::uint64_t v)
+  {
+    while (v >= 0x80)
+    {
+      out += static_cast<char>((v & 0x7F) | 0x80);
+      v >>= 7;
+    }
+    out += static_cast<char>(v);
+  }
+
+  inline void put_zigzag(std::string& out, const std::int64_t v)
+  {
+    put_varint(out, (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63));
+  }
+
+  // sequential reader of a block
+  class block_reader {
+  public:
+    block_reader(const char* data, const std::size_t size) :
+      m_data(data),
+      m_end(data + size)
+    {
+    }
+
+    std::uint8_t byte()
+    {
+      if (m_data >= m_end)
+        throw std::runtime_error("corrupted history file");
+      return static_cast<std::uint8_t>(*m_data++);
+    }
+
+    std::uint64_t varint()
+    {
+      std::uint64_t v = 0;
+      for (int shift = 0; shift < 64; shift += 7)
+      {
+        const std::uint8_t b = byte();
+        v |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80))
+          return v;
+      }
+      throw std::runtime_error("corrupted history file");
+    }
+
+    std::int64_t zigzag()
+    {
+      const std::uint64_t v = varint();
+      return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+    }
+
+    const char* bytes(const std::size_t n)
+    {
+      if (static_cast<std::size_t>(m_end - m_data) < n)
+        throw std::runtime_error("corrupted history file");
+      const char* p = m_data;
+      m_data += n;
+      return p;
+    }
+
+  private:
+    const char* m_data;
+    const char* m_end;
+  };
+
+  // list all the complete runs of a history file
+  inline std::vector<run_info> list(const std::filesystem::path& path)
+  {
+    std::vector<run_info> runs;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+      return runs;
+    file.seekg(0, std::ios::end);
+    const std::uint64_t file_size = static_cast<std::uint64_t>(file.tellg());
+    file.seekg(0);
+
+    // incomplete magic (interrupted first append): no run
+    char m[sizeof(magic)];
+    file.read(m, sizeof(m));
+    if (std::memcmp(m, magic, static_cast<std::size_t>(file.gcount())) != 0)
+      throw std::runtime_error(fmt::format("invalid history file: \"{}\"", path.u8string()));
+    if (file.gcount() != sizeof(magic))
+      return runs;
+
+    // read only the head of each block and skip its records
+    while (true)
+    {
+      run_info info;
+      info.offset = static_cast<std::uint64_t>(file.tellg());
+      if (!file.read(reinterpret_cast<char*>(&info.size), sizeof(info.size)) ||
+          info.size > file_size - info.offset - sizeof(info.size))
+        break;
+      char head[32];
+      const std::size_t head_size = static_cast<std::size_t>(std::min<std::uint64_t>(sizeof(head), info.size));
+      if (!file.read(head, static_cast<std::streamsize>(head_size)))
+        throw std::runtime_error("corrupted history file");
+      block_reader r(head, head_size);
+      info.kind = static_cast<block_kind>(r.byte());
+      info.run = r.varint();
+      info.date = r.varint();
+      info.count = r.varint();
+      runs.push_back(info);
+      file.seekg(static_cast<std::streamoff>(info.offset + sizeof(info.size) + info.size));
+    }
+    return runs;
+  }
+
+  // apply the records of one block to a state
+  inline void apply_block(const std::string& block, state& files)
+  {
+    block_reader r(block.data(), block.size());
+    const block_kind kind = static_cast<block_kind>(r.byte());
+    r.varint();
+    r.varint();
+    const std::uint64_t count = r.varint();
+    if (kind == base)
+      files.clear();
+
+    std::string name;
+    file_infos prev;
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+      const std::uint8_t op = r.byte();
+      const std::uint64_t shared = r.varint();
+      const std::uint64_t suffix = r.varint();
+      if (shared > name.size())
+        throw std::runtime_error("corrupted history file");
+      name.resize(static_cast<std::size_t>(shared));
+      name.append(r.bytes(static_cast<std::size_t>(suffix)), static_cast<std::size_t>(suffix));
+      if ((op & ~raw_sha) == remove)
+      {
+        files.erase(name);
+        continue;
+      }
+
+      file_infos infos;
+      if (op & raw_sha)
+      {
+        const std::uint64_t len = r.varint();
+        infos.sha.assign(r.bytes(static_cast<std::size_t>(len)), static_cast<std::size_t>(len));
+      }
+      else
+        infos.sha = to_hex(reinterpret_cast<const std::uint8_t*>(r.bytes(32)));
+      infos.ctime = prev.ctime + static_cast<std::uint64_t>(r.zigzag());
+      infos.mtime = prev.mtime + static_cast<std::uint64_t>(r.zigzag());
+      infos.size = r.varint();
+      prev = infos;
+      files[name] = std::move(infos);
+    }
+  }
+
+  // rebuild the state of the files as of one run (0: last run)
+  inline state load(const std::filesystem::path& path,
+                    const std::uint64_t run = 0)
+  {
+    state files;
+    const std::vector<run_info>& runs = list(path);
+    if (runs.empty())
+      return files;
+
+    // find the requested run and the last base before it
+    std::size_t last = runs.size() - 1;
+    if (run != 0)
+    {
+      while (last > 0 && runs[last].run != run)
+        --last;
+      if (runs[last].run != run)
+        throw std::runtime_error(fmt::format("run {} not found in history", run));
+    }
+    std::size_t first = last;
+    while (first > 0 && runs[first].kind != base)
+      --first;
+
+    // replay the base and the deltas
+    std::ifstream file(path, std::ios::binary);
+    for (std::size_t i = first; i <= last; ++i)
+    {
+      std::string block(static_cast<std::size_t>(runs[i].size), '\0');
+      file.seekg(static_cast<std::streamoff>(runs[i].offset + sizeof(std::uint64_t)));
+      if (!file.read(block.data(), static_cast<std::streamsize>(block.size())))
+        throw std::runtime_error("corrupted history file");
+      apply_block(block, files);
+    }
+    return files;
+  }
+
+  // encode one record
+  inline void put_record(std::string& out,
+                         std::string& prev_name,
+                         file_infos& prev,
+                         const std::string& name,
+                         const file_infos* infos)
+  {
+    std::size_t shared = 0;
+    while (shared < prev_name.size() && shared < name.size() && prev_name[shared] == name[shared])
+      ++shared;
+
+    digest d;
+    const bool binary = infos && to_digest(infos->sha, d) && to_hex(d.data()) == infos->sha;
+    out += static_cast<char>(infos ? (binary ? upsert : upsert | raw_sha) : remove);
+    put_varint(out, shared);
+    put_varint(out, name.size() - shared);
+    out.append(name, shared, std::string::npos);
+    prev_name = name;
+    if (!infos)
+      return;
+
+    if (binary)
+      out.append(reinterpret_cast<const char*>(d.data()), d.size());
+    else
+    {
+      put_varint(out, infos->sha.size());
+      out += infos->sha;
+    }
+    put_zigzag(out, static_cast<std::int64_t>(infos->ctime - prev.ctime));
+    put_zigzag(out, static_cast<std::int64_t>(infos->mtime - prev.mtime));
+    put_varint(out, infos->size);
+    prev = *infos;
+  }
+
+  // size of the complete part of a history file (0: no magic)
+  inline std::uint64_t complete_size(const std::filesystem::path& path, const std::vector<run_info>& runs)
+  {
+    if (!runs.empty())
+      return runs.back().offset + sizeof(std::uint64_t) + runs.back().size;
+    std::error_code ec;
+    return std::filesystem::file_size(path, ec) >= sizeof(magic) && !ec ? sizeof(magic) : 0;
+  }
+
+  // append the state of a new run to the history
+  // - an incomplete trailing block is truncated first
+  // - returns the run number
+  template<typename Records>
+  std::uint64_t append(const std::filesystem::path& path, const Records& files)
+  {
+    const std::vector<run_info>& runs = list(path);
+    const state& previous = load(path);
+
+    // encode the changes since the previous run (merge of sorted states)
+    std::string records;
+    std::uint64_t count = 0;
+    std::string prev_name;
+    file_infos prev;
+    auto it = previous.cbegin();
+    for (const auto& [name, infos] : files)
+    {
+      for (; it != previous.cend() && it->first < name; ++it, ++count)
+        put_record(records, prev_name, prev, it->first, nullptr);
+      if (it != previous.cend() && it->first == name)
+      {
+        const bool same = same_hash(it->second.sha, infos.sha) &&
+                          it->second.ctime == infos.ctime &&
+                          it->second.mtime == infos.mtime &&
+                          it->second.size == infos.size;
+        ++it;
+        if (same)
+          continue;
+      }
+      put_record(records, prev_name, prev, name, &infos);
+      ++count;
+    }
+    for (; it != previous.cend(); ++it, ++count)
+      put_record(records, prev_name, prev, it->first, nullptr);
+
+    // write a new base when the deltas since the last base are too big
+    std::uint64_t base_size = 0, deltas_size = 0;
+    for (auto r = runs.crbegin(); r != runs.crend(); ++r)
+    {
+      if (r->kind == base)
+      {
+        base_size = r->size;
+        break;
+      }
+      deltas_size += r->size;
+    }
+    block_kind kind = delta;
+    if (runs.empty() || (deltas_size + records.size()) * 2 > base_size)
+    {
+      kind = base;
+      records.clear();
+      count = 0;
+      prev_name.clear();
+      prev = file_infos();
+      for (const auto& [name, infos] : files)
+      {
+        put_record(records, prev_name, prev, name, &infos);
+        ++count;
+      }
+    }
+
+    // append the block
+    const std::uint64_t run = runs.empty() ? 1 : runs.back().run + 1;
+    std::string block;
+    block += static_cast<char>(kind);
+    put_varint(block, run);
+    put_varint(block, static_cast<std::uint64_t>(std::time(nullptr)));
+    put_varint(block, count);
+    block += records;
+    const std::uint64_t size = block.size();
+
+    const std::uint64_t complete = complete_size(path, runs);
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec) && std::filesystem::file_size(path) != complete)
+      std::filesystem::resize_file(path, complete);
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", path.filename().u8string()));
+    if (complete == 0)
+      file.write(magic, sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file.write(block.data(), static_cast<std::streamsize>(block.size()));
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", path.filename().u8string()));
+    return run;
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <stdexcept>
+#include <fmt/core.h>
+#include "file-infos.hpp"
+
+// json output of the results: one line per file with aligned names
+// - the results must be written sorted by name
+// - the number of lines isn't known in advance (archive members)
+// - written in a temporary file renamed once complete (the previous database stays
+//   readable during the run)
+class json_writer {
+public:
+  json_writer(const std::filesystem::path& path,
+              const std::size_t max_len) :
+    m_path(path),
+    m_tmp(std::filesystem::path(path) += ".tmp")
+  {
+    m_file.open(m_tmp, std::ios::binary);
+    if (!m_file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", m_tmp.filename().u8string()));
+
+    // reconstruct json-optimized file manually - written by lines
+    m_line_fmt += R"("name": "{:<)" + std::to_string(max_len) + R"(}, )";
+    m_line_fmt += R"("sha": "{}", )";
+    m_line_fmt += R"("ctime": {}, )";
+    m_line_fmt += R"("mtime": {}, )";
+    m_line_fmt += R"("size": {})";
+    m_file << "{\n";
+    m_file << "  \"files\": [";
+  }
+
+  ~json_writer()
+  {
+    // incomplete output: drop the temporary file
+    if (m_file.is_open())
+    {
+      m_file.close();
+      std::error_code ec;
+      std::filesystem::remove(m_tmp, ec);
+    }
+  }
+  json_writer(const json_writer&) = delete;
+  json_writer& operator=(const json_writer&) = delete;
+
+  // write the line of one file
+  void write(const std::string& name, const file_infos& infos)
+  {
+    m_file << (m_first ? "\n" : ",\n");
+    m_first = false;
+    m_file << format(name, infos);
+  }
+
+  // line of one file (without separator) - valid until the next call
+  // - the buffers are reused: no allocation once they are large enough
+  const std::string& format(const std::string& name, const file_infos& infos)
+  {
+    // json string: backslashes of the windows paths, quotes and control characters of the
+    // archive members are escaped
+    m_name.clear();
+    for (const char c : name)
+    {
+      if (c == '\\' || c == '"')
+        m_name += '\\';
+      else if (static_cast<unsigned char>(c) < 0x20)
+      {
+        m_name += fmt::format("\\u{:04x}", static_cast<unsigned>(static_cast<unsigned char>(c)));
+        continue;
+      }
+      m_name += c;
+    }
+    m_name += '"';
+    m_line.assign("    { ");
+    fmt::format_to(std::back_inserter(m_line), m_line_fmt,
+      m_name,
+      infos.sha,
+      infos.ctime,
+      infos.mtime,
+      infos.size);
+    if (!infos.midstate.empty())
+      m_line.append(R"(, "midstate": ")").append(infos.midstate).append("\"");
+    m_line.append(" }");
+    return m_line;
+  }
+
+  // terminate the json and replace the output file
+  void close()
+  {
+    m_file << "\n  ]\n";
+    m_file << "}";
+    m_file.close();
+    if (!m_file.good())
+      throw std::runtime_error(fmt::format("can't write file: \"{}\"", m_tmp.filename().u8string()));
+    std::filesystem::rename(m_tmp, m_path);
+  }
+
+private:
+  const std::filesystem::path m_path;
+  const std::filesystem::path m_tmp;
+  std::ofstream m_file;
+  std::string m_line_fmt;
+  std::string m_name;
+  std::string m_line;
+  bool m_first = true;
+};
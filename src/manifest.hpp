@@ -0,0 +1,208 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/files.hpp>
+#include <winpp/utf8.hpp>
+#include "database.hpp"
+#include "cpu-limits.hpp"
+#include "archive.hpp"
+#include "change-source.hpp"
+
+// sha256sum manifests (SHA256SUMS) of the directories
+// - import: their hashes are trusted for the files not modified after the manifest
+// - export: one manifest per directory, checkable with "sha256sum -c" (comment lines are ignored)
+// - the manifests not written by this tool (no header) are never overwritten
+namespace manifest {
+
+  // name of the manifest of a directory
+  constexpr char file_name[] = "SHA256SUMS";
+
+  // first line of the manifests written by this tool
+  constexpr char header[] = "# SHA256SUMS written by mark-files";
+
+  // manifest written by this tool (or no manifest)
+  inline bool is_own(const std::filesystem::path& path)
+  {
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+      return true;
+    std::ifstream file(path, std::ios::binary);
+    std::string line;
+    std::getline(file, line);
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    return line == header;
+  }
+
+  // entries of a manifest: name relative to its directory => sha
+  inline std::vector<std::pair<std::string, std::string>> parse(const std::filesystem::path& path)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.u8string()));
+
+    // "<sha>  <name>" (text) or "<sha> *<name>" (binary) - escaped names are skipped
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::string line;
+    while (std::getline(file, line))
+    {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      digest d;
+      if (line.size() < 66 || line[64] != ' ' || (line[65] != ' ' && line[65] != '*') || !to_digest(line.substr(0, 64), d))
+        continue;
+      std::string name = line.substr(66);
+      if (name.rfind("./", 0) == 0)
+        name.erase(0, 2);
+      std::replace(name.begin(), name.end(), '/', '\\');
+      entries.emplace_back(std::move(name), line.substr(0, 64));
+    }
+    return entries;
+  }
+
+  // seed the infos of the files listed by the manifests of the tree
+  // - known: infos of the files which don't need to be hashed (resized if empty)
+  // - returns the number of trusted hashes
+  inline std::size_t seed(const std::vector<std::filesystem::path>& files,
+                          std::vector<std::optional<change_source::known_file>>& known)
+  {
+    // hashes of all the manifests: full name => (sha, mtime of the manifest)
+    std::unordered_map<std::string, std::pair<std::string, std::uint64_t>> hashes;
+    for (const auto& f : files)
+    {
+      if (f.filename().u8string() != file_name)
+        continue;
+      const std::uint64_t mtime = static_cast<std::uint64_t>(files::get_stat(f).st_mtime);
+      const std::filesystem::path& dir = f.parent_path();
+      for (auto& [name, sha] : parse(f))
+        hashes[(dir / utf8::from_utf8(name)).u8string()] = { std::move(sha), mtime };
+    }
+    if (hashes.empty())
+      return 0;
+
+    // trust the files not modified since their manifest
+    if (known.empty())
+      known.resize(files.size());
+    std::size_t nb_trusted = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+      if (known[i])
+        continue;
+      const auto it = hashes.find(files[i].u8string());
+      if (it == hashes.end())
+        continue;
+      const struct stat& file_info = files::get_stat(files[i]);
+      if (static_cast<std::uint64_t>(file_info.st_mtime) > it->second.second)
+        continue;
+      known[i] = change_source::known_file{ {
+          it->second.first,
+          static_cast<uint64_t>(file_info.st_ctime),
+          static_cast<uint64_t>(file_info.st_mtime),
+          static_cast<uint64_t>(std::filesystem::file_size(files[i]))
+        }, {} };
+      ++nb_trusted;
+    }
+    return nb_trusted;
+  }
+
+  // write the manifest of every directory in parallel - returns the number of manifests
+  // - skipped: number of manifests of other tools left unchanged
+  // - written in a temporary file renamed at the end: an interrupted run keeps the previous manifest
+  inline std::size_t write(const std::vector<db_record>& records,
+                           std::size_t& skipped,
+                           const std::size_t nb_threads = cpu_limits::available())
+  {
+    // files of each directory (records are sorted: sorted in each directory)
+    std::map<std::filesystem::path, std::vector<const db_record*>> dirs;
+    for (const auto& r : records)
+    {
+      if (archive::is_member(r.first))
+        continue;
+      const std::filesystem::path& file = utf8::from_utf8(r.first);
+      if (file.filename().u8string() != file_name && file.filename().u8string() != std::string(file_name) + ".tmp")
+        dirs[file.parent_path()].push_back(&r);
+    }
+    std::vector<std::pair<const std::filesystem::path*, const std::vector<const db_record*>*>> todo;
+    for (const auto& [dir, entries] : dirs)
+      todo.emplace_back(&dir, &entries);
+
+    std::mutex mutex;
+    std::size_t next = 0;
+    std::size_t nb_written = 0;
+    skipped = 0;
+    std::exception_ptr error;
+    auto worker = [&]() {
+      while (true)
+      {
+        std::size_t index;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (next >= todo.size())
+            break;
+          index = next++;
+        }
+        try
+        {
+          // "<sha>  <name>": text mode line of sha256sum
+          const std::filesystem::path& dir = *todo[index].first;
+          const std::filesystem::path& path = dir / file_name;
+          if (!is_own(path))
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++skipped;
+            continue;
+          }
+          const std::filesystem::path& tmp = dir / (std::string(file_name) + ".tmp");
+          std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+          file << header << "\n";
+          for (const db_record* r : *todo[index].second)
+          {
+            std::string sha = r->second.sha;
+            std::transform(sha.begin(), sha.end(), sha.begin(), [](const char c) {
+              return static_cast<char>((c >= 'A' && c <= 'F') ? c - 'A' + 'a' : c);
+              });
+            const std::filesystem::path& name = utf8::from_utf8(r->first);
+            file << sha << "  " << name.filename().u8string() << "\n";
+          }
+          file.close();
+          if (!file.good())
+          {
+            std::error_code ec;
+            std::filesystem::remove(tmp, ec);
+            throw std::runtime_error(fmt::format("can't write file: \"{}\"", path.u8string()));
+          }
+          std::filesystem::rename(tmp, path);
+          std::lock_guard<std::mutex> lock(mutex);
+          ++nb_written;
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error)
+            error = std::current_exception();
+          next = todo.size();
+        }
+      }
+    };
+    std::vector<std::thread> threads(std::max<std::size_t>(1, std::min(nb_threads, todo.size())));
+    for (auto& t : threads)
+      t = std::thread(worker);
+    for (auto& t : threads)
+      if (t.joinable())
+        t.join();
+    if (error)
+      std::rethrow_exception(error);
+    return nb_written;
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/win.hpp>
+
+// read-only memory mapping of a whole file
+class mapped_file {
+public:
+  explicit mapped_file(const std::filesystem::path& path)
+  {
+    m_file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+      throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.u8string()));
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size))
+    {
+      CloseHandle(m_file);
+      throw std::runtime_error(fmt::format("can't retrieve size of file: \"{}\"", path.u8string()));
+    }
+    m_size = static_cast<std::uint64_t>(size.QuadPart);
+    if (m_size == 0)
+      return;
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+      m_data = static_cast<const std::uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+    {
+      if (m_mapping)
+        CloseHandle(m_mapping);
+      CloseHandle(m_file);
+      throw std::runtime_error(fmt::format("can't map file: \"{}\"", path.u8string()));
+    }
+  }
+
+  ~mapped_file()
+  {
+    if (m_data)
+      UnmapViewOfFile(m_data);
+    if (m_mapping)
+      CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+      CloseHandle(m_file);
+  }
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  const std::uint8_t* data() const { return m_data; }
+  std::uint64_t size() const { return m_size; }
+
+private:
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+  const std::uint8_t* m_data = nullptr;
+  std::uint64_t m_size = 0;
+};
@@ -1,14 +1,20 @@
+// winsock2 must be included before windows.h (pulled by winpp)
+#include <winsock2.h>
 #include <string>
 #include <filesystem>
 #include <vector>
 #include <tuple>
-#include <regex>
 #include <map>
+#include <unordered_map>
 #include <ctime>
 #include <queue>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <limits>
 #include <fmt/core.h>
 #include <fmt/format.h>
 #include <fmt/color.h>
@@ -21,6 +27,29 @@
 #include <winpp/win.hpp>
 #include <fort.hpp>
 #include <nlohmann/json.hpp>
+#include "file-infos.hpp"
+#include "distributed.hpp"
+#include "multi-process.hpp"
+#include "database.hpp"
+#include "content-index.hpp"
+#include "db-index.hpp"
+#include "enumerate.hpp"
+#include "result-writer.hpp"
+#include "sqlite-writer.hpp"
+#include "arrow-writer.hpp"
+#include "history.hpp"
+#include "ordered-results.hpp"
+#include "radix-sort.hpp"
+#include "json-writer.hpp"
+#include "copy-tree.hpp"
+#include "archive.hpp"
+#include "change-source.hpp"
+#include "manifest.hpp"
+#include "resume-hash.hpp"
+#include "cpu-limits.hpp"
+#include "throttle.hpp"
+#include "perf-counters.hpp"
+#include "vfs.hpp"
 
 using json = nlohmann::ordered_json;
 
@@ -34,11 +63,23 @@ const std::string PROGRAM_VERSION = "1.6.0";
 // default length in characters to align status 
 constexpr std::size_t g_status_len = 50;
 
-// file information that will be extracted/computed
-struct file_infos {
-  std::string sha;
-  std::uint64_t ctime = 0;
-  std::uint64_t mtime = 0;
+// options of the extraction of infos
+struct extract_options {
+  bool restore = false;
+  std::size_t nb_workers = 0;
+  std::size_t nb_processes = 0;
+  std::string format = "json";
+  std::size_t row_group_size = 1024 * 1024;
+  std::filesystem::path history;
+  uint64_t history_run = 0;
+  bool archives = false;
+  bool incremental = false;
+  std::string files_from;
+  bool import_sums = false;
+  bool export_sums = false;
+  bool resumable = false;
+  throttle::thresholds throttle;
+  std::string simulate;
 };
 
 /*============================================
@@ -49,13 +90,52 @@ auto add_tag = [](const fmt::color color, const std::string& text) {
   fmt::print(fmt::format(fmt::fg(color) | fmt::emphasis::bold, "[{}]\n", text));
 };
 
+// convert a timestamp to a local date
+std::string to_date(const uint64_t timestamp)
+{
+  char buf[128];
+  std::time_t ts = timestamp;
+  struct tm* timeinfo = localtime(&ts);
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", timeinfo);
+  return buf;
+}
+
+// convert a local date (YYYY-MM-DD [HH:MM:SS]) or a timestamp to a timestamp
+uint64_t from_date(const std::string& date)
+{
+  if (!date.empty() && date.find_first_not_of("0123456789") == std::string::npos)
+    return std::stoull(date);
+  std::tm tm = {};
+  std::istringstream ss(date);
+  ss >> std::get_time(&tm, date.size() > 10 ? "%Y-%m-%d %H:%M:%S" : "%Y-%m-%d");
+  if (ss.fail())
+    throw std::runtime_error(fmt::format("invalid date: \"{}\"", date));
+  tm.tm_isdst = -1;
+  return static_cast<uint64_t>(std::mktime(&tm));
+}
+
+// parse a range "min..max" (each bound is optional)
+std::pair<uint64_t, uint64_t> parse_range(const std::string& range,
+                                          std::function<uint64_t(const std::string&)> parse)
+{
+  const std::size_t pos = range.find("..");
+  if (pos == std::string::npos)
+    throw std::runtime_error(fmt::format("invalid range: \"{}\" (expected min..max)", range));
+  const std::string& min = range.substr(0, pos);
+  const std::string& max = range.substr(pos + 2);
+  return { min.empty() ? 0 : parse(min),
+           max.empty() ? std::numeric_limits<uint64_t>::max() : parse(max) };
+}
+
 // execute a sequence of actions with tags
 void exec(const std::string& str, std::function<void()> fct)
 {
   fmt::print(fmt::emphasis::bold, "{:<" + std::to_string(g_status_len) + "}", str + ": ");
   try
   {
+    const perf_counters::sample& start = perf_counters::g_report.begin();
     fct();
+    perf_counters::g_report.end(str, start);
     add_tag(fmt::color::green, "OK");
   }
   catch (const std::exception& ex)
@@ -65,36 +145,98 @@ void exec(const std::string& str, std::function<void()> fct)
   }
 }
 
-// extract info for one file - thread
+// extract info for the files - thread
 void extract_info(std::mutex& mutex,
-                  std::queue<std::filesystem::path>& files,
-                  std::map<std::string, struct file_infos>& files_infos,
+                  std::size_t& next,
+                  const std::vector<std::filesystem::path>& files,
+                  std::vector<std::optional<change_source::known_file>>& known,
+                  const std::unordered_map<std::string, std::string>& midstates,
+                  ordered_results& results,
+                  std::vector<std::string>& archive_warnings,
+                  const extract_options& options,
+                  vfs::backend& fs,
+                  throttle::pool& pool,
+                  const std::size_t thread_index,
                   console::progress_bar& progress_bar)
 {
   while (true)
   {
-    // retrieve one file from queue - protected by mutex
-    std::filesystem::path file;
+    // pause while the system is under pressure
+    if (!pool.wait(thread_index))
+      break;
+
+    // retrieve the index of one file - protected by mutex
+    std::size_t index;
     {
       std::lock_guard<std::mutex> lock(mutex);
-      if (files.empty())
+      if (next >= files.size())
+      {
+        pool.finish();
         break;
-      file = files.front();
-      files.pop();
+      }
+      index = next++;
     }
 
-    // retrieve infos for one file
-    const struct stat& file_info = files::get_stat(file);
-    const std::string& file_hash = files::get_hash(file);
+    // wait for the consumer to be close enough (reorder window)
+    if (!results.reserve(index))
+      break;
 
-    // update database and progress_bar - protected by mutex
+    // retrieve infos for one file and store it in its slot
+    // - unchanged since the previous scan (incremental): infos of the database
+    // - archives: the members are hashed during the read of the archive (plain file if unreadable)
+    // - resumable: hashed from the state saved by the previous run
+    const std::filesystem::path& file = files[index];
+    if (!known.empty() && known[index])
+      results.store(index, std::move(known[index]->infos), std::move(known[index]->members));
+    else if (options.archives && archive::get_kind(file) != archive::kind::none)
+    {
+      std::vector<db_record> members;
+      std::vector<std::string> skipped;
+      try
+      {
+        const struct stat& file_info = files::get_stat(file);
+        file_infos infos = {
+          archive::read(file, members, skipped),
+          static_cast<uint64_t>(file_info.st_ctime),
+          static_cast<uint64_t>(file_info.st_mtime),
+          static_cast<uint64_t>(std::filesystem::file_size(file))
+        };
+        results.store(index, std::move(infos), std::move(members));
+
+        // members not hashed (encrypted, unsupported compression): the archive isn't fully indexed
+        if (!skipped.empty())
+        {
+          std::string names;
+          for (std::size_t i = 0; i < std::min<std::size_t>(skipped.size(), 5); ++i)
+            names += (i > 0 ? ", " : "") + skipped[i];
+          if (skipped.size() > 5)
+            names += ", ...";
+          std::lock_guard<std::mutex> lock(mutex);
+          archive_warnings.push_back(fmt::format("{} member(s) of archive not hashed: \"{}\": {}",
+            skipped.size(), file.u8string(), names));
+        }
+      }
+      catch (const std::exception& ex)
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          archive_warnings.push_back(fmt::format("can't read archive (hashed as a plain file): \"{}\": {}",
+            file.u8string(), ex.what()));
+        }
+        results.store(index, fs.get_file_infos(file));
+      }
+    }
+    else if (options.resumable)
+    {
+      const auto it = midstates.find(file.u8string());
+      results.store(index, resume_hash::get_file_infos(file, it != midstates.end() ? it->second : std::string()));
+    }
+    else
+      results.store(index, fs.get_file_infos(file));
+
+    // update progress_bar - protected by mutex
     {
       std::lock_guard<std::mutex> lock(mutex);
-      files_infos[file.u8string()] = {
-        file_hash, 
-        static_cast<uint64_t>(file_info.st_ctime), 
-        static_cast<uint64_t>(file_info.st_mtime)
-      };
       progress_bar.tick();
     }
   }
@@ -103,172 +245,423 @@ void extract_info(std::mutex& mutex,
 // extract infos for all files
 void extract_infos(const std::filesystem::path& path,
                    const std::filesystem::path& output,
-                   bool restore = false)
+                   const extract_options& options)
 {
-  // retrieve all files path from directory not hidden (not starting with .)
+  const bool restore = options.restore;
+  const std::size_t nb_workers = options.nb_workers;
+  const std::size_t nb_processes = options.nb_processes;
+
+  // file system of the files: the disk or a simulated tree (benchmarks)
+  std::unique_ptr<vfs::backend> fs;
+  if (options.simulate.empty())
+    fs = std::make_unique<vfs::native>();
+  else
+    fs = std::make_unique<vfs::simulated>(path, vfs::parse(options.simulate));
+
+  // incremental scan: list of the files rebuilt from the database and the changes of the journal
+  // (or the list of changed files given by the user)
   std::vector<std::filesystem::path> all_files;
-  exec("extract all files' path from directory", [&]() {
-    const auto& dir_filter = [&](const std::filesystem::path& p) {
-      return p.string().find("\\.") == std::string::npos;
-    };
-    all_files = files::get_files(path,
-                                 files::infinite_depth,
-                                 false,
-                                 dir_filter,
-                                 files::default_filter);
-    });
+  std::vector<std::optional<change_source::known_file>> known;
+  std::unique_ptr<change_source::source> changes;
+  change_source::position position;
+  bool listed = false;
+  if (!options.files_from.empty())
+  {
+    if (!std::filesystem::exists(output))
+      throw std::runtime_error(fmt::format("the list of files needs an existing database: \"{}\"", output.u8string()));
+    change_source::changes changed;
+    exec("read the list of changed files", [&]() {
+      changed = change_source::read_list(options.files_from, path);
+      });
+    exec("rebuild files' list from the database and the list", [&]() {
+      change_source::merge(path, output, changed, options.archives, all_files, known);
+      });
+    listed = true;
+  }
+  else if (options.incremental)
+  {
+    changes = std::make_unique<change_source::usn_journal>(path);
+    position = changes->current();
+    change_source::position saved;
+    change_source::changes changed;
+    if (std::filesystem::exists(output) &&
+        change_source::load(change_source::state_path(output), saved) &&
+        changes->list(saved, position, changed))
+    {
+      exec("rebuild files' list from the database and the journal", [&]() {
+        change_source::merge(path, output, changed, options.archives, all_files, known);
+        });
+      listed = true;
+      fmt::print("{} changed file(s) and {} changed directory(ies) since the previous scan\n",
+        changed.files.size(), changed.dirs.size());
+    }
+    else
+      fmt::print("{} changes since the previous scan unavailable: full scan\n",
+        fmt::format(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold, "warning:"));
+  }
 
-  // extract infos for all files
-  std::map<std::string, struct file_infos> files_infos;
-  if (!all_files.empty())
+  // retrieve all files path from directory not hidden (not starting with .) - in output order
+  // - workers: the sizes of the listing are kept to balance the partitions
+  std::vector<std::uint64_t> sizes;
+  if (!listed)
   {
-    console::progress_bar progress_bar("extract infos for all files:", all_files.size());
+    exec("extract all files' path from directory", [&]() {
+      if (nb_workers > 0)
+      {
+        for (auto& e : enumerate::sorted_entries(path))
+        {
+          all_files.push_back(std::filesystem::u8path(e.name));
+          sizes.push_back(e.size);
+        }
+      }
+      else
+        all_files = fs->sorted_files(path);
+      });
+  }
 
-    // initialize a queue of files
-    std::queue<std::filesystem::path> files(
-      std::deque<std::filesystem::path>(all_files.begin(), all_files.end()));
+  // hashes of the sha256sum manifests of the tree: trusted if the file is older than its manifest
+  if (options.import_sums)
+  {
+    std::size_t nb_trusted = 0;
+    exec("import the sha256sum manifests", [&]() {
+      nb_trusted = manifest::seed(all_files, known);
+      });
+    fmt::print("{} hash(es) imported from the manifests\n", nb_trusted);
+  }
 
-    // start threads
-    std::mutex mutex;
-    const std::size_t max_cpu = static_cast<std::size_t>(std::thread::hardware_concurrency());
-    const std::size_t nb_threads = std::min(files.size(), max_cpu);
-    std::vector<std::thread> threads(nb_threads);
-    for (auto& t : threads)
-      t = std::thread(extract_info,
-                      std::ref(mutex),
-                      std::ref(files),
-                      std::ref(files_infos),
-                      std::ref(progress_bar));
+  if (all_files.empty())
+    throw std::runtime_error("empty directory");
 
-    // wait for threads completion
-    for (auto& t : threads)
-      if (t.joinable())
-        t.join();
+  // hash states saved by the previous run
+  std::unordered_map<std::string, std::string> midstates;
+  if (options.resumable)
+  {
+    exec("load the hash states of the database", [&]() {
+      read_database(output, [&](db_record&& r) {
+        if (!r.second.midstate.empty())
+          midstates.emplace(std::move(r.first), std::move(r.second.midstate));
+        });
+      });
   }
-  if (files_infos.empty())
-    throw std::runtime_error("empty directory");
 
+  // output formats other than json are written by their own thread
+  std::unique_ptr<result_writer> writer;
+  if (options.format == "sqlite")
+    writer = std::make_unique<sqlite_writer>(output);
+  else if (options.format == "parquet")
+    writer = std::make_unique<arrow_writer>(output, arrow_writer::format::parquet, options.row_group_size);
+  else if (options.format == "arrow")
+    writer = std::make_unique<arrow_writer>(output, arrow_writer::format::arrow, options.row_group_size);
+
+  // json output: names are aligned on the longest one
+  std::unique_ptr<json_writer> json;
+  if (!writer)
+  {
+    std::size_t max_len = 0;
+    for (const auto& f : all_files)
+      max_len = std::max(max_len, f.u8string().size());
+    json = std::make_unique<json_writer>(output, max_len);
+  }
+
+  // extract infos for all files: results are stored in the slot of their index
+  // - threads can't go further than the reorder window ahead of the output
+  // - workers and processes don't follow the order: no window
+  const bool ordered = nb_workers == 0 && nb_processes == 0;
+  ordered_results results(all_files.size(), ordered ? g_reorder_window : 0);
+  throttle::pool pool(options.throttle, std::min(all_files.size(), cpu_limits::available()));
+  const perf_counters::sample& hashing_start = perf_counters::g_report.begin();
+  console::progress_bar progress_bar("extract infos for all files:", all_files.size());
+  std::vector<std::string> archive_warnings;
+  std::thread hashing([&]() {
+    try
+    {
+      if (nb_workers > 0)
+      {
+        // distribute the files to local worker processes
+        distributed::coordinate(all_files,
+                                sizes,
+                                std::min(all_files.size(), nb_workers),
+                                results,
+                                progress_bar);
+      }
+      else if (nb_processes > 0)
+      {
+        // share the files between processes through shared memory
+        multi_process::run(all_files,
+                           std::min(all_files.size(), nb_processes),
+                           results,
+                           progress_bar);
+      }
+      else
+      {
+        // start threads
+        std::mutex mutex;
+        std::size_t next = 0;
+        const std::size_t max_cpu = cpu_limits::available();
+        const std::size_t nb_threads = std::min(all_files.size(), max_cpu);
+        std::vector<std::thread> threads(nb_threads);
+        for (std::size_t i = 0; i < threads.size(); ++i)
+          threads[i] = std::thread([&, i]() {
+            try
+            {
+              extract_info(mutex, next, all_files, known, midstates, results, archive_warnings, options, *fs, pool, i, progress_bar);
+              perf_counters::g_report.add_thread(perf_counters::thread_counters(fmt::format("hashing thread {}", i)));
+            }
+            catch (...)
+            {
+              results.fail(std::current_exception());
+              pool.finish();
+            }
+          });
+
+        // wait for threads completion
+        for (auto& t : threads)
+          if (t.joinable())
+            t.join();
+      }
+    }
+    catch (...)
+    {
+      results.fail(std::current_exception());
+    }
+    });
+
+  // results sorted by name: kept for the database index and the history (json)
+  std::vector<db_record> files_infos;
+  std::vector<db_record> shard;
+  std::size_t nb_unsorted = 0;
+  std::vector<db_record> unsorted;
   std::vector<std::tuple<std::string,
                          bool, uint64_t, uint64_t,
                          bool, uint64_t, uint64_t>> to_update;
-  if (restore)
+  std::exception_ptr error;
+  try
   {
-    // parse json file infos
-    json saved_db;
-    exec("parsing json file", [&]() {
-      std::ifstream file(output);
-      if (file.good())
-        saved_db = json::parse(file);
-      });
-
-    // detect all files that have changed dates
-    exec("detect all files that have changed dates", [&]() {
-      if (saved_db.contains("files") && saved_db["files"].is_array())
+    // output the next result as soon as it is available
+    std::string name;
+    auto front = [&]() -> file_infos& {
+      file_infos& infos = results.front();
+      if (name.empty())
+        name = all_files[results.position()].u8string();
+      return infos;
+    };
+    auto emit = [&](std::string&& n, const file_infos& infos) {
+      if (writer)
       {
-        for (auto& i : saved_db["files"])
+        shard.emplace_back(std::move(n), infos);
+        if (shard.size() >= g_shard_size)
         {
-          // check entry validity
-          if ((!i.contains("name")  || !i["name"].is_string())  ||
-              (!i.contains("sha")   || !i["sha"].is_string())   ||
-              (!i.contains("ctime") || !i["ctime"].is_number()) ||
-              (!i.contains("mtime") || !i["mtime"].is_number()))
-            continue;
-
-          // retrieve fields of this entry
-          const std::string& name    = i["name"].get<std::string>();
-          const std::string& old_sha = i["sha"].get<std::string>();
-          const uint64_t old_ctime   = i["ctime"].get<uint64_t>();
-          const uint64_t old_mtime   = i["mtime"].get<uint64_t>();
-
-          // check if this file existed in the saved database
-          auto it = files_infos.find(name);
-          if (it == files_infos.end())
-            continue;
-
-          // check if the checksum have changed
-          if (it->second.sha != old_sha)
-            continue;
-
-          // checksum are identical => dates needs to be restored if changed
-          bool ctime = false;
-          const uint64_t new_ctime = it->second.ctime;
-          if (new_ctime != old_ctime)
-          {
-            it->second.ctime = old_ctime;
-            ctime = true;
-          }
+          writer->push(std::move(shard));
+          shard.clear();
+        }
+      }
+      else
+      {
+        json->write(n, infos);
+        files_infos.emplace_back(std::move(n), infos);
+      }
+    };
 
-          bool mtime = false;
-          const uint64_t new_mtime = it->second.mtime;
-          if (new_mtime != old_mtime)
-          {
-            it->second.mtime = old_mtime;
-            mtime = true;
-          }
+    // archive members waiting for their place in the output (sorted by name)
+    std::map<std::string, file_infos> members;
+    auto flush_members = [&](const std::string* until) {
+      while (!members.empty() && (!until || members.begin()->first < *until))
+      {
+        auto node = members.extract(members.begin());
+        emit(std::move(node.key()), node.mapped());
+      }
+    };
+    auto pop = [&]() {
+      const file_infos& infos = results.front();
+      for (auto& m : results.members())
+        members.insert_or_assign(std::move(m.first), std::move(m.second));
+      flush_members(&name);
+      emit(std::move(name), infos);
+      name.clear();
+      results.pop();
+    };
 
-          if (ctime || mtime)
-            to_update.push_back(std::make_tuple(name, 
-                                                ctime, old_ctime, new_ctime,
-                                                mtime, old_mtime, new_mtime));
-        }
+    // output all the results up to a name - returns the result with this name (if any)
+    auto forward = [&](const std::string& until) -> file_infos* {
+      while (results.position() < results.size())
+      {
+        file_infos& infos = front();
+        if (name >= until)
+          return name == until ? &infos : nullptr;
+        pop();
+      }
+      return nullptr;
+    };
+
+    // checksum are identical => dates needs to be restored if changed - true if restored
+    auto restore_dates = [&](const std::string& saved_name, file_infos& infos, const file_infos& old_infos) {
+      if (!same_hash(infos.sha, old_infos.sha))
+        return false;
+      const uint64_t old_ctime = old_infos.ctime;
+      const uint64_t old_mtime = old_infos.mtime;
+      bool ctime = false;
+      const uint64_t new_ctime = infos.ctime;
+      if (new_ctime != old_ctime)
+      {
+        infos.ctime = old_ctime;
+        ctime = true;
+      }
+
+      bool mtime = false;
+      const uint64_t new_mtime = infos.mtime;
+      if (new_mtime != old_mtime)
+      {
+        infos.mtime = old_mtime;
+        mtime = true;
       }
-      });
 
-    // restore dates to original values
-    if (!to_update.empty())
+      // restore dates to original values
+      if (!ctime && !mtime)
+        return false;
+      fs->set_times(utf8::from_utf8(saved_name),
+                    ctime ? old_ctime : 0,
+                    mtime ? old_mtime : 0);
+      to_update.push_back(std::make_tuple(saved_name,
+                                          ctime, old_ctime, new_ctime,
+                                          mtime, old_mtime, new_mtime));
+      return true;
+    };
+
+    if (restore)
     {
-      console::progress_bar progress_bar("restore dates to original values:", to_update.size());
-      for (const auto& file : to_update)
+      // merge join of the sorted saved database with the sorted results
+      // - the saved database is streamed: it is never loaded in memory
+      // - dates are restored before the result is written
+      // - unsorted entries of the saved database are restored by lookup once all the
+      //   results are handed (the json is rewritten)
+      std::string last;
+      auto join = [&](const std::string& saved_name, const file_infos& old_infos) {
+        // the results have already been written past an unsorted entry
+        if (saved_name < last)
+        {
+          unsorted.emplace_back(saved_name, old_infos);
+          return;
+        }
+        last = saved_name;
+
+        // check if this file existed in the saved database
+        file_infos* infos = forward(saved_name);
+        if (infos)
+          restore_dates(saved_name, *infos, old_infos);
+      };
+
+      // stream the json file infos (or the state of a run of the history)
+      if (options.history_run > 0)
       {
-        files::set_stat(utf8::from_utf8(std::get<0>(file)),
-                        std::get<1>(file) ? std::get<2>(file) : 0,
-                        0,
-                        std::get<4>(file) ? std::get<5>(file) : 0);
-        progress_bar.tick();
+        for (const auto& [saved_name, old_infos] : history::load(options.history, options.history_run))
+          join(saved_name, old_infos);
       }
+      else
+      {
+        read_database(output, [&](const db_record& r) {
+          join(r.first, r.second);
+          });
+      }
+    }
+
+    // output the remaining results
+    while (results.position() < results.size())
+    {
+      front();
+      pop();
     }
+    flush_members(nullptr);
+
+    // unsorted entries of the saved database: lookup of the results (sorted by name)
+    for (const auto& [saved_name, old_infos] : unsorted)
+    {
+      auto it = std::lower_bound(files_infos.begin(), files_infos.end(), saved_name, [](const db_record& r, const std::string& n) {
+        return r.first < n;
+        });
+      if (it != files_infos.end() && it->first == saved_name && restore_dates(saved_name, it->second, old_infos))
+        ++nb_unsorted;
+    }
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+    results.cancel();
+    pool.finish();
+  }
+  if (hashing.joinable())
+    hashing.join();
+  if (error)
+    std::rethrow_exception(error);
+  perf_counters::g_report.end("extract infos for all files", hashing_start);
+  if (pool.backoffs() > 0)
+    fmt::print("the hashing threads have been reduced {} time(s) to yield to the system\n", pool.backoffs());
+  if (!fs->summary().empty())
+    fmt::print("simulated file system: {}\n", fs->summary());
+  for (const auto& e : archive_warnings)
+    fmt::print("{} {}\n",
+      fmt::format(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold, "warning:"),
+      e);
+
+  // other output formats: finalize the output once all the results are handed
+  if (writer)
+  {
+    exec(fmt::format("write to {} file", options.format), [&]() {
+      writer->push(std::move(shard));
+      writer->close();
+      });
+    return;
   }
 
   // write json to file
   exec("write to json file", [&]() {
-    std::ofstream file(output, std::ios::binary);
-    if (!file.good())
-      throw std::runtime_error(fmt::format("can't write file: \"{}\"", output.filename().u8string()));
-
-    // detect maximum length of filename
-    std::size_t max_len = 0;
-    for (const auto& [k, v] : files_infos)
-      if (k.size() > max_len)
-        max_len = k.size();
-
-    // reconstruct json-optimized file manually
-    std::string line_fmt;
-    line_fmt += R"("name": "{:<)" + std::to_string(max_len) + R"(}, )";
-    line_fmt += R"("sha": "{}", )";
-    line_fmt += R"("ctime": {}, )";
-    line_fmt += R"("mtime": {})";
-    std::string content;
-    content += "{\n";
-    content += "  \"files\": [\n";
-    for (const auto& [k, v] : files_infos)
+    // dates restored by lookup (unsorted saved database): the written lines are outdated
+    if (nb_unsorted > 0)
     {
-      content += "    { ";
-      content += fmt::format(line_fmt,
-        std::regex_replace(k, std::regex("\\\\"), "\\\\") + "\"",
-        v.sha,
-        v.ctime,
-        v.mtime);
-      content += " }";
-      content += (k == files_infos.rbegin()->first) ? "" : ",";
-      content += "\n";
+      std::size_t max_len = 0;
+      for (const auto& f : all_files)
+        max_len = std::max(max_len, f.u8string().size());
+      json.reset();
+      json = std::make_unique<json_writer>(output, max_len);
+      for (const auto& [name, infos] : files_infos)
+        json->write(name, infos);
     }
-    content += "  ]\n";
-    content += "}";
+    json->close();
+    });
+  if (changes)
+    change_source::save(change_source::state_path(output), position);
+  if (!unsorted.empty())
+    fmt::print("{} {} entries of the saved database aren't sorted: {} file(s) restored by lookup\n",
+      fmt::format(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold, "warning:"),
+      unsorted.size(),
+      nb_unsorted);
 
-    // write to file
-    file << content;
+  // write binary index of the database for queries
+  exec("write database index", [&]() {
+    db_index::write(files_infos, db_index::index_path(output));
     });
 
+  // keep track of this run in the history
+  if (!options.history.empty())
+  {
+    exec("append run to history", [&]() {
+      history::append(options.history, files_infos);
+      });
+  }
+
+  // write the sha256sum manifest of each directory
+  if (options.export_sums)
+  {
+    std::size_t nb_skipped = 0;
+    exec("write the sha256sum manifests", [&]() {
+      manifest::write(files_infos, nb_skipped);
+      });
+    if (nb_skipped > 0)
+      fmt::print("{} {} SHA256SUMS manifest(s) not written by {} left unchanged\n",
+        fmt::format(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold, "warning:"),
+        nb_skipped,
+        PROGRAM_NAME);
+  }
+
   // display table of update files
   if (!to_update.empty())
   {
@@ -289,23 +682,16 @@ void extract_infos(const std::filesystem::path& path,
     // add rows
     for (const auto& f : to_update)
     {
-      auto to_str = [&](const uint64_t timestamp) -> const std::string { 
-        char buf[128];
-        std::time_t ts = timestamp;
-        struct tm* timeinfo = localtime(&ts);
-        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", timeinfo);
-        return buf;
-      };
       table << std::get<0>(f);
       table << (std::get<1>(f) ? 
         fmt::format("{} => {}", 
-          to_str(std::get<3>(f)), 
-          to_str(std::get<2>(f))) : 
+          to_date(std::get<3>(f)), 
+          to_date(std::get<2>(f))) : 
         "");
       table << (std::get<4>(f) ? 
         fmt::format("{} => {}",
-          to_str(std::get<6>(f)),
-          to_str(std::get<5>(f))) :
+          to_date(std::get<6>(f)),
+          to_date(std::get<5>(f))) :
         "");
       table << fort::endr;
     }
@@ -313,6 +699,524 @@ void extract_infos(const std::filesystem::path& path,
   }
 }
 
+// copy a directory: the files are hashed while they are copied
+void copy_files(const std::filesystem::path& path,
+                const std::filesystem::path& dst,
+                const std::filesystem::path& output,
+                const std::filesystem::path& copy_output,
+                const bool verify)
+{
+  // retrieve all files path from directory not hidden (not starting with .) - in output order
+  std::vector<std::filesystem::path> all_files;
+  exec("extract all files' path from directory", [&]() {
+    all_files = enumerate::sorted_files(path);
+    });
+
+  if (all_files.empty())
+    throw std::runtime_error("empty directory");
+
+  // destination of each file - same order since the relative paths are the same
+  std::vector<std::filesystem::path> targets;
+  exec("create destination directories", [&]() {
+    targets.reserve(all_files.size());
+    std::filesystem::path last;
+    for (const auto& f : all_files)
+    {
+      targets.push_back(dst / f.lexically_relative(path));
+      const std::filesystem::path& parent = targets.back().parent_path();
+      if (parent != last)
+      {
+        std::filesystem::create_directories(parent);
+        last = parent;
+      }
+    }
+    });
+
+  // copy all files using threads
+  std::vector<file_infos> files_infos(all_files.size());
+  {
+    console::progress_bar progress_bar(verify ? "copy and verify all files:" : "copy all files:", all_files.size());
+    std::mutex mutex;
+    std::size_t next = 0;
+    std::exception_ptr error;
+    const std::size_t max_cpu = cpu_limits::available();
+    std::vector<std::thread> threads(std::min(all_files.size(), max_cpu));
+    for (auto& t : threads)
+      t = std::thread([&]() {
+        try
+        {
+          copy_tree::aligned_buffer buffer;
+          while (true)
+          {
+            // retrieve the index of one file - protected by mutex
+            std::size_t index;
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              if (next >= all_files.size())
+                break;
+              index = next++;
+            }
+
+            // copy (and verify) one file
+            files_infos[index] = copy_tree::copy_file(all_files[index], targets[index], buffer);
+            if (verify)
+              copy_tree::verify(targets[index], files_infos[index].sha, buffer);
+
+            // update progress_bar - protected by mutex
+            std::lock_guard<std::mutex> lock(mutex);
+            progress_bar.tick();
+          }
+        }
+        catch (...)
+        {
+          // stop all the threads
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error)
+            error = std::current_exception();
+          next = all_files.size();
+        }
+      });
+    for (auto& t : threads)
+      if (t.joinable())
+        t.join();
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  // write the database (and its index) of one side of the copy
+  auto write_database = [&](const std::filesystem::path& db, const std::vector<std::filesystem::path>& names) {
+    std::vector<db_record> records;
+    records.reserve(names.size());
+    std::size_t max_len = 0;
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+      records.emplace_back(names[i].u8string(), files_infos[i]);
+      max_len = std::max(max_len, records.back().first.size());
+    }
+    json_writer json(db, max_len);
+    for (const auto& [name, infos] : records)
+      json.write(name, infos);
+    json.close();
+    db_index::write(records, db_index::index_path(db));
+  };
+  exec("write source json file", [&]() {
+    write_database(output, all_files);
+    });
+  if (!copy_output.empty())
+  {
+    exec("write destination json file", [&]() {
+      write_database(copy_output, targets);
+      });
+  }
+}
+
+// apply the timestamps of the files of a directory to the identical files of another one
+void sync_times(const std::filesystem::path& src,
+                const std::filesystem::path& dst)
+{
+  // list both directories at the same time
+  std::vector<enumerate::entry> src_entries;
+  std::vector<enumerate::entry> dst_entries;
+  exec("extract all files' properties from directories", [&]() {
+    std::exception_ptr dst_error;
+    std::thread dst_thread([&]() {
+      try
+      {
+        dst_entries = enumerate::sorted_entries(dst);
+      }
+      catch (...)
+      {
+        dst_error = std::current_exception();
+      }
+      });
+    std::exception_ptr src_error;
+    try
+    {
+      src_entries = enumerate::sorted_entries(src);
+    }
+    catch (...)
+    {
+      src_error = std::current_exception();
+    }
+    dst_thread.join();
+    if (src_error)
+      std::rethrow_exception(src_error);
+    if (dst_error)
+      std::rethrow_exception(dst_error);
+    });
+
+  // walk both sorted lists in lockstep: only the files with the same size can be identical
+  std::vector<std::pair<std::size_t, std::size_t>> candidates;
+  std::size_t nb_matched = 0;
+  exec("match the files of both directories", [&]() {
+    const std::size_t src_len = enumerate::prefix_length(src);
+    const std::size_t dst_len = enumerate::prefix_length(dst);
+    std::size_t i = 0, j = 0;
+    while (i < src_entries.size() && j < dst_entries.size())
+    {
+      const std::string_view& a = std::string_view(src_entries[i].name).substr(src_len);
+      const std::string_view& b = std::string_view(dst_entries[j].name).substr(dst_len);
+      if (a < b)
+        ++i;
+      else if (b < a)
+        ++j;
+      else
+      {
+        if (src_entries[i].size == dst_entries[j].size)
+          candidates.emplace_back(i, j);
+        ++nb_matched;
+        ++i;
+        ++j;
+      }
+    }
+    });
+
+  // hash the pairs whose timestamps differ and apply the source timestamps if identical
+  std::vector<std::tuple<std::string,
+                         bool, uint64_t, uint64_t,
+                         bool, uint64_t, uint64_t>> to_update;
+  std::size_t nb_hashed = 0;
+  if (!candidates.empty())
+  {
+    console::progress_bar progress_bar("synchronize timestamps of files:", candidates.size());
+    std::mutex mutex;
+    std::size_t next = 0;
+    std::exception_ptr error;
+    const std::size_t max_cpu = cpu_limits::available();
+    std::vector<std::thread> threads(std::min(candidates.size(), max_cpu));
+    for (auto& t : threads)
+      t = std::thread([&]() {
+        try
+        {
+          while (true)
+          {
+            // retrieve one pair of files - protected by mutex
+            std::size_t index;
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              if (next >= candidates.size())
+                break;
+              index = next++;
+            }
+            const std::filesystem::path& src_file = utf8::from_utf8(src_entries[candidates[index].first].name);
+            const std::string& dst_name = dst_entries[candidates[index].second].name;
+            const std::filesystem::path& dst_file = utf8::from_utf8(dst_name);
+
+            // compare the timestamps first: no read when they are identical
+            const struct stat& src_stat = files::get_stat(src_file);
+            const struct stat& dst_stat = files::get_stat(dst_file);
+            const uint64_t src_ctime = static_cast<uint64_t>(src_stat.st_ctime);
+            const uint64_t src_mtime = static_cast<uint64_t>(src_stat.st_mtime);
+            const uint64_t dst_ctime = static_cast<uint64_t>(dst_stat.st_ctime);
+            const uint64_t dst_mtime = static_cast<uint64_t>(dst_stat.st_mtime);
+            const bool ctime = src_ctime != dst_ctime;
+            const bool mtime = src_mtime != dst_mtime;
+            const bool hash = ctime || mtime;
+            const bool identical = hash && same_hash(files::get_hash(src_file), files::get_hash(dst_file));
+            if (identical)
+              files::set_stat(dst_file, ctime ? src_ctime : 0, 0, mtime ? src_mtime : 0);
+
+            // update results and progress_bar - protected by mutex
+            std::lock_guard<std::mutex> lock(mutex);
+            if (hash)
+              ++nb_hashed;
+            if (identical)
+              to_update.push_back(std::make_tuple(dst_name,
+                                                  ctime, src_ctime, dst_ctime,
+                                                  mtime, src_mtime, dst_mtime));
+            progress_bar.tick();
+          }
+        }
+        catch (...)
+        {
+          // stop all the threads
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error)
+            error = std::current_exception();
+          next = candidates.size();
+        }
+      });
+    for (auto& t : threads)
+      if (t.joinable())
+        t.join();
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  // display table of synchronized files
+  if (!to_update.empty())
+  {
+    std::sort(to_update.begin(), to_update.end());
+    fort::utf8_table table;
+    table.set_border_style(FT_NICE_STYLE);
+    table.column(0).set_cell_text_align(fort::text_align::left);
+    table.column(0).set_cell_content_text_style(fort::text_style::bold);
+    for (int i = 1; i < 3; ++i)
+      table.column(i).set_cell_text_align(fort::text_align::center);
+    table << fort::header << "FILE" << "SYNCED CTIME" << "SYNCED MTIME" << fort::endr;
+    for (const auto& f : to_update)
+    {
+      table << std::get<0>(f);
+      table << (std::get<1>(f) ? fmt::format("{} => {}", to_date(std::get<3>(f)), to_date(std::get<2>(f))) : "");
+      table << (std::get<4>(f) ? fmt::format("{} => {}", to_date(std::get<6>(f)), to_date(std::get<5>(f))) : "");
+      table << fort::endr;
+    }
+    fmt::print("\n{}\n", table.to_string());
+  }
+  fmt::print("\n{} file(s) matched: {} with the same size, {} hashed, {} synchronized\n",
+    nb_matched, candidates.size(), nb_hashed, to_update.size());
+}
+
+// build the content index of all databases found in a directory
+void build_index(const std::filesystem::path& dir,
+                 const std::filesystem::path& index)
+{
+  // retrieve all the databases - other json files are skipped
+  std::vector<std::filesystem::path> dbs;
+  std::vector<std::filesystem::path> skipped;
+  exec("find all databases in directory", [&]() {
+    dbs = content_index::find_databases(dir, skipped);
+    if (dbs.empty())
+      throw std::runtime_error("no database found");
+    });
+  for (const auto& s : skipped)
+    fmt::print("{} not a database (skipped): \"{}\"\n",
+      fmt::format(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold, "warning:"),
+      s.u8string());
+
+  // load databases and write index
+  std::vector<std::string> errors;
+  console::progress_bar progress_bar("load all databases:", dbs.size());
+  content_index::build(dbs, index, errors, progress_bar);
+  for (const auto& e : errors)
+    fmt::print("{} can't load database (indexed without files): {}\n",
+      fmt::format(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold, "warning:"),
+      e);
+}
+
+// lookup a hash (or the hash of a file) in the content index
+void lookup_index(const std::filesystem::path& index,
+                  const std::string& hash_or_file)
+{
+  // retrieve the digest to search
+  digest d;
+  exec("retrieve the hash to search", [&]() {
+    const std::filesystem::path file = utf8::from_utf8(hash_or_file);
+    const std::string& sha = std::filesystem::is_regular_file(file) ? files::get_hash(file) : hash_or_file;
+    if (!to_digest(sha, d))
+      throw std::runtime_error(fmt::format("invalid hash: \"{}\"", sha));
+    });
+
+  // search the digest in the index
+  const content_index::reader reader(index);
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<content_index::match>& matches = reader.find(d);
+  const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+  fmt::print("{} found {} file(s) in {} us\n", to_hex(d.data()), matches.size(), elapsed.count());
+  if (matches.empty())
+    return;
+
+  // display table of found files
+  fort::utf8_table table;
+  table.set_border_style(FT_NICE_STYLE);
+  table.column(0).set_cell_text_align(fort::text_align::left);
+  table.column(1).set_cell_text_align(fort::text_align::left);
+  table.column(1).set_cell_content_text_style(fort::text_style::bold);
+  table << fort::header << "DATABASE" << "FILE" << fort::endr;
+  for (const auto& m : matches)
+    table << m.database << m.path << fort::endr;
+  fmt::print("\n{}\n", table.to_string());
+}
+
+// (re)build the index of a database if the database is more recent
+void update_db_index(const std::filesystem::path& db)
+{
+  if (!db_index::is_outdated(db))
+    return;
+  exec("build database index", [&]() {
+    std::vector<db_record> records = load_database(db);
+    radix_sort::permute(records, radix_sort::order(records.size(), [&](const std::uint32_t i) {
+      return std::string_view(records[i].first);
+      }));
+    db_index::write(records, db_index::index_path(db));
+    });
+}
+
+// query a database through its binary index
+void query_database(const std::filesystem::path& db,
+                    const db_index::query& query)
+{
+  update_db_index(db);
+
+  // run the query on the mapped index
+  const db_index::reader reader(db_index::index_path(db));
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<db_record>& records = reader.find(query);
+  const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+  fmt::print("found {} file(s) out of {} in {} us\n", records.size(), reader.size(), elapsed.count());
+  if (records.empty())
+    return;
+
+  // display table of found files
+  fort::utf8_table table;
+  table.set_border_style(FT_NICE_STYLE);
+  table.column(0).set_cell_text_align(fort::text_align::left);
+  table.column(0).set_cell_content_text_style(fort::text_style::bold);
+  for (int i = 1; i < 5; ++i)
+    table.column(i).set_cell_text_align(fort::text_align::center);
+  table << fort::header << "FILE" << "SHA" << "SIZE" << "CTIME" << "MTIME" << fort::endr;
+  for (const auto& [name, infos] : records)
+    table << name << infos.sha << infos.size << to_date(infos.ctime) << to_date(infos.mtime) << fort::endr;
+  fmt::print("\n{}\n", table.to_string());
+}
+
+// compare a live directory with a database using only the directory listing (no hashing)
+void status(const std::filesystem::path& path,
+            const std::filesystem::path& db)
+{
+  update_db_index(db);
+  const db_index::reader reader(db_index::index_path(db));
+
+  // retrieve size and mtime of all files
+  std::vector<enumerate::entry> entries;
+  exec("extract all files' properties from directory", [&]() {
+    entries = enumerate::files(path);
+    radix_sort::permute(entries, radix_sort::order(entries.size(), [&](const std::uint32_t i) {
+      return std::string_view(entries[i].name);
+      }));
+    });
+
+  // merge the sorted directory listing with the sorted database
+  std::size_t nb_new = 0, nb_deleted = 0, nb_modified = 0;
+  std::string root = path.u8string();
+  if (!root.empty() && root.back() != '\\' && root.back() != '/')
+    root += '\\';
+  auto print = [](const fmt::color color, const std::string& status, const std::string_view& name) {
+    fmt::print("  {}{}\n", fmt::format(fmt::fg(color), "{:<12}", status), name);
+  };
+  auto it = entries.cbegin();
+  auto flush_new = [&](const std::string_view* until) {
+    for (; it != entries.cend() && (!until || it->name < *until); ++it, ++nb_new)
+      print(fmt::color::green, "new:", it->name);
+  };
+  fmt::print("\n");
+  reader.for_each([&](const std::string_view& name, const db_index::record& r) {
+    // only compare the files belonging to the directory (not the archive members)
+    if (name.substr(0, root.size()) != root || archive::is_member(name))
+      return;
+    flush_new(&name);
+    if (it == entries.cend() || it->name != name)
+    {
+      print(fmt::color::red, "deleted:", name);
+      ++nb_deleted;
+      return;
+    }
+    // size is unknown (0) in older databases
+    if (it->size != r.size && r.size != 0)
+    {
+      print(fmt::color::yellow, "size:", name);
+      ++nb_modified;
+    }
+    else if (it->mtime != r.mtime)
+    {
+      print(fmt::color::yellow, "mtime:", name);
+      ++nb_modified;
+    }
+    ++it;
+    });
+  flush_new(nullptr);
+  fmt::print("\n{} file(s): {} new, {} deleted, {} modified\n", entries.size(), nb_new, nb_deleted, nb_modified);
+}
+
+// display all the runs of a history file
+void list_history(const std::filesystem::path& history)
+{
+  const std::vector<history::run_info>& runs = history::list(history);
+  if (runs.empty())
+    throw std::runtime_error(fmt::format("no run found in history: \"{}\"", history.u8string()));
+
+  fort::utf8_table table;
+  table.set_border_style(FT_NICE_STYLE);
+  for (int i = 0; i < 5; ++i)
+    table.column(i).set_cell_text_align(fort::text_align::center);
+  table.column(0).set_cell_content_text_style(fort::text_style::bold);
+  table << fort::header << "RUN" << "DATE" << "TYPE" << "RECORDS" << "BYTES" << fort::endr;
+  for (const auto& r : runs)
+    table << r.run << to_date(r.date) << (r.kind == history::base ? "base" : "delta") << r.count << r.size << fort::endr;
+  fmt::print("\n{}\n", table.to_string());
+}
+
+// display the counters of the phases and of the hashing threads
+// - with the heap columns and the top allocation sites when the allocations are tracked
+void print_counters()
+{
+  auto mb = [](const std::uint64_t bytes) {
+    return fmt::format("{:.1f} MB", static_cast<double>(bytes) / (1024.0 * 1024.0));
+  };
+  auto add_rows = [&](fort::utf8_table& table, const std::vector<perf_counters::counters>& rows, const bool phases) {
+    for (const auto& c : rows)
+    {
+      // effective frequency of the processors while running
+      const double ghz = c.cpu_us > 0 ? static_cast<double>(c.cycles) / static_cast<double>(c.cpu_us) / 1000.0 : 0.0;
+      table << c.name;
+      if (phases)
+        table << fmt::format("{:.3f} s", c.seconds);
+      table << fmt::format("{:.3f} s", static_cast<double>(c.cpu_us) / 1e6)
+            << fmt::format("{:.2f} G", static_cast<double>(c.cycles) / 1e9)
+            << fmt::format("{:.2f}", ghz);
+      if (phases)
+        table << c.page_faults << c.reads << mb(c.read_bytes);
+      if (alloc_tracking::enabled)
+      {
+        table << c.allocations << mb(c.allocated_bytes);
+        if (phases)
+          table << mb(c.peak_heap);
+      }
+      table << fort::endr;
+    }
+  };
+  auto create_table = [](fort::utf8_table& table, const std::vector<std::string>& header) {
+    table.set_border_style(FT_NICE_STYLE);
+    table.column(0).set_cell_text_align(fort::text_align::left);
+    table.column(0).set_cell_content_text_style(fort::text_style::bold);
+    for (std::size_t i = 1; i < header.size(); ++i)
+      table.column(i).set_cell_text_align(fort::text_align::right);
+    table << fort::header;
+    for (const auto& h : header)
+      table << h;
+    table << fort::endr;
+  };
+
+  std::vector<std::string> header = { "PHASE", "TIME", "CPU", "CYCLES", "GHZ", "PAGE FAULTS", "READS", "READ" };
+  if (alloc_tracking::enabled)
+    header.insert(header.end(), { "ALLOCS", "ALLOCATED", "PEAK HEAP" });
+  fort::utf8_table table;
+  create_table(table, header);
+  add_rows(table, perf_counters::g_report.phases(), true);
+  fmt::print("\n{}\n", table.to_string());
+
+  if (!perf_counters::g_report.threads().empty())
+  {
+    header = { "THREAD", "CPU", "CYCLES", "GHZ" };
+    if (alloc_tracking::enabled)
+      header.insert(header.end(), { "ALLOCS", "ALLOCATED" });
+    fort::utf8_table threads;
+    create_table(threads, header);
+    add_rows(threads, perf_counters::g_report.threads(), false);
+    fmt::print("{}\n", threads.to_string());
+  }
+
+  // sites with the most allocations
+  if (alloc_tracking::enabled)
+  {
+    fort::utf8_table sites;
+    create_table(sites, { "ALLOCATION SITE", "ALLOCS", "ALLOCATED" });
+    for (const auto& site : alloc_tracking::top_sites(20))
+      sites << alloc_tracking::describe(site) << site.allocations << mb(site.bytes) << fort::endr;
+    fmt::print("{}\n", sites.to_string());
+  }
+}
+
 int main(int argc, char** argv)
 {
   // initialize Windows console
@@ -322,11 +1226,75 @@ int main(int argc, char** argv)
   std::filesystem::path path;
   std::filesystem::path output;
   bool restore = false;
+  std::string format = "json";
+  int row_group_size = 1024 * 1024;
+  int workers = 0;
+  std::string worker;
+  int processes = 0;
+  std::string shm_worker;
+  std::filesystem::path index;
+  std::filesystem::path index_build;
+  std::string index_lookup;
+  std::filesystem::path db;
+  std::string query_path;
+  std::string query_hash;
+  std::string query_prefix;
+  std::string query_size;
+  std::string query_date;
+  bool show_status = false;
+  std::filesystem::path history;
+  int history_run = 0;
+  bool history_list = false;
+  std::filesystem::path copy;
+  std::filesystem::path copy_output;
+  bool copy_verify = false;
+  std::filesystem::path sync;
+  bool archives = false;
+  bool incremental = false;
+  std::string files_from;
+  bool import_sums = false;
+  bool export_sums = false;
+  bool resumable = false;
+  std::string throttle_loads;
+  bool counters = false;
+  std::string simulate;
   bool interactive = false;
   console::parser parser(PROGRAM_NAME, PROGRAM_VERSION);
-  parser.add("p", "path", "set the path that needs to be analyzed", path, true)
-        .add("o", "output", "store all the extracted properties into a json file", output, true)
+  parser.add("p", "path", "set the path that needs to be analyzed", path)
+        .add("o", "output", "store all the extracted properties into a json file", output)
         .add("r", "restore", "restore the timestamp of all un-modified files", restore)
+        .add("f", "format", "set the output format: json (default), sqlite, parquet or arrow", format)
+        .add("rg", "row-group-size", "set the number of rows per row group (parquet) or batch (arrow)", row_group_size)
+        .add("w", "workers", "distribute the hashing to this number of local worker processes", workers)
+        .add("wk", "worker", "run as a worker process connected to a coordinator (host:port)", worker)
+        .add("n", "processes", "hash the files with this number of processes sharing memory", processes)
+        .add("sw", "shm-worker", "run as a worker process attached to a shared memory", shm_worker)
+        .add("x", "index", "set the content index file used by --index-build/--index-lookup", index)
+        .add("xb", "index-build", "build the content index of all the databases of a directory", index_build)
+        .add("xl", "index-lookup", "search a hash (or the hash of a file) in the content index", index_lookup)
+        .add("d", "db", "set the database (json file) to query", db)
+        .add("qp", "query-path", "query the database for this file path", query_path)
+        .add("qh", "query-hash", "query the database for the files with this hash", query_hash)
+        .add("qx", "query-prefix", "query the database for the files starting with this path", query_prefix)
+        .add("qs", "query-size", "query the database for the files in this size range (min..max)", query_size)
+        .add("qd", "query-date", "query the database for the files modified in this range (YYYY-MM-DD..YYYY-MM-DD)", query_date)
+        .add("s", "status", "compare the directory with the database (--db) without hashing", show_status)
+        .add("hf", "history", "append the results of this run to a history file", history)
+        .add("hr", "history-run", "restore the timestamps saved by this run of the history (with --restore)", history_run)
+        .add("hl", "history-list", "list all the runs of the history file", history_list)
+        .add("c", "copy", "copy the directory to this destination and hash the files during the copy", copy)
+        .add("co", "copy-output", "store the properties of the copied files into this json file", copy_output)
+        .add("cv", "copy-verify", "verify the copied files by reading them again without the system cache", copy_verify)
+        .add("st", "sync-times", "apply the timestamps of the directory to the identical files of this directory", sync)
+        .add("a", "archives", "hash the members of the archives (tar, tar.gz, tar.zst, zip) as virtual files", archives)
+        .add("in", "incremental", "only hash the files changed since the previous scan (ntfs usn journal)", incremental)
+        .add("ff", "files-from", "only hash the files of this list (one per line or nul-separated, - for stdin)", files_from)
+        .add("is", "import-sums", "trust the hashes of the SHA256SUMS manifests for the files older than them", import_sums)
+        .add("es", "export-sums", "write a SHA256SUMS manifest (sha256sum -c) in each directory (except the manifests of other tools)", export_sums)
+        .add("rs", "resumable", "save the hash state of the files: only the appended bytes of growing files are read", resumable)
+        .add("th", "throttle", "reduce the hashing threads above these loads in percent (cpu=80,memory=90,io=70)", throttle_loads)
+        .add("pc", "counters", "display the processor, memory and read counters of each phase and thread", counters)
+        .add("sim", "simulate", "hash a generated tree instead of the disk (files=100,dirs=10,depth=2,size=64k,read=1ms,jitter=500us,errors=0.001 - the first injected error aborts the run)", simulate)
         .add("i", "interactive", "enable the interactive mode which asks user for questions", interactive);
   if (!parser.parse(argc, argv))
   {
@@ -334,20 +1302,153 @@ int main(int argc, char** argv)
     return -1;
   }
 
+  // worker modes: hash the files sent by the coordinator or from shared memory
+  if (!worker.empty() || !shm_worker.empty())
+  {
+    try
+    {
+      if (!worker.empty())
+        distributed::run_worker(worker);
+      else
+        multi_process::run_worker(shm_worker);
+      return 0;
+    }
+    catch (const std::exception& ex)
+    {
+      fmt::print("{} {}\n",
+        fmt::format(fmt::fg(fmt::color::red) | fmt::emphasis::bold, "error:"),
+        ex.what());
+      return -1;
+    }
+  }
+  const bool index_mode = !index_build.empty() || !index_lookup.empty();
+  const bool query_mode = !db.empty() && !show_status;
+  if ((index_mode && index.empty()) ||
+      (history_list && history.empty()) ||
+      (!sync.empty() && path.empty()) ||
+      (show_status && (path.empty() || db.empty())) ||
+      (!index_mode && !query_mode && !show_status && !history_list && sync.empty() && (path.empty() || output.empty())))
+  {
+    parser.print_usage();
+    return -1;
+  }
+
+  if (counters)
+    perf_counters::g_report.enable();
+
   int ret;
   try
   {
-    // check arguments validity
-    if (!std::filesystem::exists(path))
-      throw std::runtime_error(fmt::format("the directory: \"{}\" doesn't exists", path.u8string()));
+    // number of threads: limited by the affinity and the job object (containers)
+    if (!query_mode && !show_status && !history_list && index_lookup.empty())
+      fmt::print("using {} thread(s): {}\n", cpu_limits::available(), cpu_limits::get().reason);
 
-    // acquire system wide mutex to avoid multiples executions of mark-files in //
-    fmt::print(fmt::emphasis::bold, "{}\n", "waiting for other mark-files programs to terminate...");
-    win::system_mutex mtx("Global\\MarkFiles");
-    std::lock_guard<win::system_mutex> lock(mtx);
+    // content index modes: read-only on the databases
+    if (!index_build.empty())
+      build_index(index_build, index);
+    else if (!index_lookup.empty())
+      lookup_index(index, index_lookup);
+    else if (show_status)
+      status(path, db);
+    else if (history_list)
+      list_history(history);
+    else if (!sync.empty())
+      sync_times(path, sync);
+    else if (query_mode)
+    {
+      // build the query from all the criteria
+      db_index::query query;
+      if (!query_path.empty())
+        query.path = query_path;
+      if (!query_prefix.empty())
+        query.prefix = query_prefix;
+      if (!query_hash.empty())
+      {
+        digest d;
+        if (!to_digest(query_hash, d))
+          throw std::runtime_error(fmt::format("invalid hash: \"{}\"", query_hash));
+        query.hash = d;
+      }
+      if (!query_size.empty())
+        query.size = parse_range(query_size, [](const std::string& s) { return std::stoull(s); });
+      if (!query_date.empty())
+        query.mtime = parse_range(query_date, from_date);
+      query_database(db, query);
+    }
+    else
+    {
+      // check arguments validity
+      if (simulate.empty() && !std::filesystem::exists(path))
+        throw std::runtime_error(fmt::format("the directory: \"{}\" doesn't exists", path.u8string()));
+
+      // acquire system wide mutex to avoid multiples executions of mark-files in //
+      fmt::print(fmt::emphasis::bold, "{}\n", "waiting for other mark-files programs to terminate...");
+      win::system_mutex mtx("Global\\MarkFiles");
+      std::lock_guard<win::system_mutex> lock(mtx);
+
+      // extract infos for all files
+      if (workers < 0 || processes < 0)
+        throw std::runtime_error("the number of workers/processes can't be negative");
+      if (workers > 0 && processes > 0)
+        throw std::runtime_error("workers and processes modes can't be combined");
+      if (static_cast<std::size_t>(processes) > multi_process::max_processes)
+        throw std::runtime_error(fmt::format("the number of processes can't exceed {}", multi_process::max_processes));
+      if (format != "json" && format != "sqlite" && format != "parquet" && format != "arrow")
+        throw std::runtime_error(fmt::format("unknown output format: \"{}\"", format));
+      if (restore && format != "json")
+        throw std::runtime_error("the restore mode needs the json format");
+      if (!history.empty() && format != "json")
+        throw std::runtime_error("the history needs the json format");
+      if (history_run < 0 || (history_run > 0 && (history.empty() || !restore)))
+        throw std::runtime_error("the history run needs --history and --restore");
+      extract_options options;
+      options.restore = restore;
+      options.nb_workers = static_cast<std::size_t>(workers);
+      options.nb_processes = static_cast<std::size_t>(processes);
+      options.format = format;
+      if (row_group_size <= 0)
+        throw std::runtime_error("the row group size must be positive");
+      options.row_group_size = static_cast<std::size_t>(row_group_size);
+      options.history = history;
+      options.history_run = static_cast<uint64_t>(history_run);
+      if (archives && (workers > 0 || processes > 0 || !copy.empty()))
+        throw std::runtime_error("the archives mode only supports threads (no copy)");
+      options.archives = archives;
+      if (incremental && (format != "json" || !copy.empty()))
+        throw std::runtime_error("the incremental mode needs the json format (no copy)");
+      options.incremental = incremental;
+      if (!files_from.empty() && (format != "json" || !copy.empty() || incremental))
+        throw std::runtime_error("the list of files needs the json format (no copy, no incremental)");
+      options.files_from = files_from;
+      if ((import_sums || export_sums) && !copy.empty())
+        throw std::runtime_error("the manifests aren't supported by the copy mode");
+      if (export_sums && format != "json")
+        throw std::runtime_error("the export of the manifests needs the json format");
+      options.import_sums = import_sums;
+      options.export_sums = export_sums;
+      if (resumable && (format != "json" || workers > 0 || processes > 0 || !copy.empty()))
+        throw std::runtime_error("the resumable mode only supports the json format with threads (no copy)");
+      options.resumable = resumable;
+      options.throttle = throttle::parse(throttle_loads);
+      if (options.throttle.enabled() && (workers > 0 || processes > 0 || !copy.empty()))
+        throw std::runtime_error("the throttle only supports threads (no copy)");
+      if (!simulate.empty() && (workers > 0 || processes > 0 || !copy.empty() || archives || incremental ||
+                                !files_from.empty() || import_sums || export_sums || resumable))
+        throw std::runtime_error("the simulated file system only supports the hashing by threads");
+      options.simulate = simulate;
+      if (!copy.empty())
+      {
+        if (restore || format != "json" || workers > 0 || processes > 0)
+          throw std::runtime_error("the copy mode only supports the json format with threads");
+        copy_files(path, copy, output, copy_output, copy_verify);
+      }
+      else
+        extract_infos(path, output, options);
+    }
 
-    // extract infos for all files
-    extract_infos(path, output, restore);
+    // counters of the phases
+    if (perf_counters::g_report.enabled())
+      print_counters();
     ret = 0;
   }
   catch (const std::exception& ex)
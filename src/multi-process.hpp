@@ -0,0 +1,274 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <vector>
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/progress-bar.hpp>
+#include <winpp/utf8.hpp>
+#include <winpp/win.hpp>
+#include "file-infos.hpp"
+#include "process.hpp"
+#include "ordered-results.hpp"
+
+// multi-process hashing: the files are hashed by several processes sharing
+// a named memory mapping (mark-files --shm-worker <name>)
+//
+// memory layout:
+//   header | offsets of paths [count + 1] | utf-8 paths | result slots [count]
+// - the queue of files is a lock-free cursor on the path-table indexes
+// - each file has its own result slot: workers never write the same memory
+namespace multi_process {
+
+  // identifier of the memory mapping layout
+  constexpr std::uint64_t magic = 0x3153454C4946524DULL;
+
+  // interval to refresh the progress-bar (ms)
+  constexpr DWORD refresh_interval = 100;
+
+  // maximum length of a hash stored in a slot
+  constexpr std::size_t max_sha_len = 128;
+
+  // maximum number of processes: their progression is followed by waiting on all of them at once
+  constexpr std::size_t max_processes = MAXIMUM_WAIT_OBJECTS;
+
+  struct header {
+    std::uint64_t magic;
+    std::uint64_t count;
+    std::uint64_t blob_size;
+    std::atomic<std::uint64_t> next;
+    std::atomic<std::uint64_t> done;
+  };
+
+  enum slot_state : std::uint32_t {
+    slot_pending = 0,
+    slot_done = 1
+  };
+
+  struct slot {
+    std::atomic<std::uint32_t> state;
+    std::uint32_t sha_len;
+    std::uint64_t ctime;
+    std::uint64_t mtime;
+    std::uint64_t size;
+    char sha[max_sha_len];
+  };
+
+  // named memory mapping backed by the paging file
+  class shared_memory {
+  public:
+    // create a new mapping
+    shared_memory(const std::string& name, const std::uint64_t size)
+    {
+      m_handle = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                    static_cast<DWORD>(size >> 32),
+                                    static_cast<DWORD>(size & 0xFFFFFFFF),
+                                    utf8::from_utf8(name).c_str());
+      if (!m_handle)
+        throw std::runtime_error(fmt::format("can't create shared memory: {}", GetLastError()));
+      map();
+    }
+
+    // open an existing mapping
+    explicit shared_memory(const std::string& name)
+    {
+      m_handle = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, utf8::from_utf8(name).c_str());
+      if (!m_handle)
+        throw std::runtime_error(fmt::format("can't open shared memory: {}", GetLastError()));
+      map();
+    }
+
+    ~shared_memory()
+    {
+      if (m_data)
+        UnmapViewOfFile(m_data);
+      if (m_handle)
+        CloseHandle(m_handle);
+    }
+    shared_memory(const shared_memory&) = delete;
+    shared_memory& operator=(const shared_memory&) = delete;
+
+    std::uint8_t* data() const { return m_data; }
+
+  private:
+    void map()
+    {
+      m_data = static_cast<std::uint8_t*>(MapViewOfFile(m_handle, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+      if (!m_data)
+      {
+        CloseHandle(m_handle);
+        throw std::runtime_error(fmt::format("can't map shared memory: {}", GetLastError()));
+      }
+    }
+
+    HANDLE m_handle = nullptr;
+    std::uint8_t* m_data = nullptr;
+  };
+
+  // pointers to the different parts of the mapping
+  struct view {
+    header* hdr;
+    std::uint64_t* offsets;
+    char* blob;
+    slot* slots;
+  };
+
+  inline std::uint64_t align(const std::uint64_t v)
+  {
+    return (v + 7) & ~static_cast<std::uint64_t>(7);
+  }
+
+  inline std::uint64_t mapping_size(const std::uint64_t count, const std::uint64_t blob_size)
+  {
+    return align(sizeof(header)) + align((count + 1) * sizeof(std::uint64_t)) + align(blob_size) + count * sizeof(slot);
+  }
+
+  inline view get_view(std::uint8_t* data)
+  {
+    view v;
+    v.hdr = reinterpret_cast<header*>(data);
+    const std::uint64_t count = v.hdr->count;
+    std::uint8_t* p = data + align(sizeof(header));
+    v.offsets = reinterpret_cast<std::uint64_t*>(p);
+    p += align((count + 1) * sizeof(std::uint64_t));
+    v.blob = reinterpret_cast<char*>(p);
+    p += align(v.hdr->blob_size);
+    v.slots = reinterpret_cast<slot*>(p);
+    return v;
+  }
+
+  // hash files until the shared queue is empty
+  inline void process_files(view& v)
+  {
+    while (true)
+    {
+      const std::uint64_t i = v.hdr->next.fetch_add(1);
+      if (i >= v.hdr->count)
+        break;
+
+      const std::string file(v.blob + v.offsets[i], v.blob + v.offsets[i + 1]);
+      const file_infos& infos = get_file_infos(utf8::from_utf8(file));
+      if (infos.sha.size() > max_sha_len)
+        throw std::runtime_error(fmt::format("hash too long for file: \"{}\"", file));
+
+      slot& s = v.slots[i];
+      s.sha_len = static_cast<std::uint32_t>(infos.sha.size());
+      std::memcpy(s.sha, infos.sha.data(), infos.sha.size());
+      s.ctime = infos.ctime;
+      s.mtime = infos.mtime;
+      s.size = infos.size;
+      s.state.store(slot_done, std::memory_order_release);
+      v.hdr->done.fetch_add(1);
+    }
+  }
+
+  // hash all the files using multiple processes
+  inline void run(const std::vector<std::filesystem::path>& files,
+                  const std::size_t nb_processes,
+                  ordered_results& results,
+                  console::progress_bar& progress_bar)
+  {
+    // build the path-table
+    std::vector<std::string> paths;
+    paths.reserve(files.size());
+    std::uint64_t blob_size = 0;
+    for (const auto& f : files)
+    {
+      paths.push_back(f.u8string());
+      blob_size += paths.back().size();
+    }
+
+    // create and initialize the shared memory
+    const std::string name = fmt::format("Local\\mark-files-{}-{}", GetCurrentProcessId(), GetTickCount64());
+    shared_memory shm(name, mapping_size(files.size(), blob_size));
+    header* hdr = new (shm.data()) header;
+    hdr->magic = magic;
+    hdr->count = files.size();
+    hdr->blob_size = blob_size;
+    hdr->next.store(0);
+    hdr->done.store(0);
+    view v = get_view(shm.data());
+    std::uint64_t offset = 0;
+    for (std::size_t i = 0; i < paths.size(); ++i)
+    {
+      v.offsets[i] = offset;
+      std::memcpy(v.blob + offset, paths[i].data(), paths[i].size());
+      offset += paths[i].size();
+      new (&v.slots[i]) slot;
+      v.slots[i].state.store(slot_pending);
+    }
+    v.offsets[paths.size()] = offset;
+
+    // start the processes and follow their progression
+    std::vector<PROCESS_INFORMATION> processes;
+    std::size_t published = 0;
+    bool cancelled = false;
+    try
+    {
+      // the progression is followed by waiting on all the processes at once
+      if (nb_processes > max_processes)
+        throw std::runtime_error(fmt::format("too many processes: {} (maximum {})", nb_processes, max_processes));
+      for (std::size_t i = 0; i < nb_processes; ++i)
+        processes.push_back(process::spawn_self("--shm-worker " + name));
+
+      std::vector<HANDLE> handles;
+      for (const auto& pi : processes)
+        handles.push_back(pi.hProcess);
+      std::uint64_t ticks = 0;
+      while (true)
+      {
+        const DWORD ret = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), TRUE, refresh_interval);
+        for (const std::uint64_t done = hdr->done.load(); ticks < done; ++ticks)
+          progress_bar.tick();
+
+        // hand the completed prefix to the consumer - refused: cancelled by the consumer
+        for (; !cancelled && published < paths.size() && v.slots[published].state.load(std::memory_order_acquire) == slot_done; ++published)
+        {
+          const slot& s = v.slots[published];
+          cancelled = !results.store(published, { std::string(s.sha, s.sha_len), s.ctime, s.mtime, s.size });
+        }
+        if (cancelled || ret != WAIT_TIMEOUT)
+          break;
+      }
+    }
+    catch (...)
+    {
+      process::wait_all(processes, true);
+      throw;
+    }
+    process::wait_all(processes, cancelled);
+    if (cancelled)
+      return;
+
+    // hash the files left by crashed processes in this process
+    for (std::size_t i = published; i < paths.size(); ++i)
+    {
+      if (v.slots[i].state.load(std::memory_order_acquire) != slot_done)
+      {
+        if (!results.store(i, get_file_infos(files[i])))
+          return;
+        progress_bar.tick();
+      }
+      else
+      {
+        const slot& s = v.slots[i];
+        if (!results.store(i, { std::string(s.sha, s.sha_len), s.ctime, s.mtime, s.size }))
+          return;
+      }
+    }
+  }
+
+  // run as a worker: hash the files of the shared queue
+  inline void run_worker(const std::string& name)
+  {
+    shared_memory shm(name);
+    view v = get_view(shm.data());
+    if (v.hdr->magic != magic)
+      throw std::runtime_error(fmt::format("invalid shared memory: \"{}\"", name));
+    process_files(v);
+  }
+}
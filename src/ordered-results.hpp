@@ -0,0 +1,134 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "file-infos.hpp"
+#include "database.hpp"
+
+// number of results that can be stored ahead of the consumer (reorder window)
+constexpr std::size_t g_reorder_window = 64 * 1024;
+
+// results stored in slots pre-assigned by enumeration index and consumed in this order
+// - producers store the result of any index, the consumer retrieves the results
+//   in order as soon as the prefix is complete
+// - with a window, producers can't go further than the window ahead of the consumer
+//   and the slots are reused (ring)
+class ordered_results {
+public:
+  // window of 0: unbounded (all the results can be stored ahead)
+  explicit ordered_results(const std::size_t count, const std::size_t window = 0) :
+    m_count(count),
+    m_slots(std::max<std::size_t>(1, window == 0 ? count : std::min(count, window)))
+  {
+  }
+  ordered_results(const ordered_results&) = delete;
+  ordered_results& operator=(const ordered_results&) = delete;
+
+  // producer: wait until an index is inside the window - false if cancelled
+  bool reserve(const std::size_t index)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_producers.wait(lock, [&]() { return index < m_next + m_slots.size() || m_cancelled; });
+    return !m_cancelled;
+  }
+
+  // producer: store the result of an index - false if it was already stored or cancelled
+  // - members: records found inside the file (archive members)
+  bool store(const std::size_t index, file_infos&& infos, std::vector<db_record>&& members = {})
+  {
+    if (!reserve(index))
+      return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    slot& s = m_slots[index % m_slots.size()];
+    if (index < m_next || s.done)
+      return false;
+    s.infos = std::move(infos);
+    s.members = std::move(members);
+    s.done = true;
+    if (index == m_next)
+      m_consumer.notify_one();
+    return true;
+  }
+
+  // producer: report an error to the consumer
+  void fail(std::exception_ptr error)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_error)
+        m_error = error;
+    }
+    m_consumer.notify_all();
+  }
+
+  // consumer: stop all the producers (consumer error)
+  void cancel()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_cancelled = true;
+    }
+    m_producers.notify_all();
+  }
+
+  // consumer: wait for the result of the next index
+  file_infos& front()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    slot& s = m_slots[m_next % m_slots.size()];
+    m_consumer.wait(lock, [&]() { return s.done || m_error; });
+    if (!s.done)
+      std::rethrow_exception(m_error);
+    return s.infos;
+  }
+
+  // consumer: records found inside the file of the next index (after front)
+  std::vector<db_record>& members()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slots[m_next % m_slots.size()].members;
+  }
+
+  // consumer: release the result of the next index
+  void pop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      slot& s = m_slots[m_next % m_slots.size()];
+      s.done = false;
+      s.infos = file_infos();
+      s.members.clear();
+      ++m_next;
+    }
+    m_producers.notify_all();
+  }
+
+  // consumer: index of the next result
+  std::size_t position() const
+  {
+    return m_next;
+  }
+
+  std::size_t size() const
+  {
+    return m_count;
+  }
+
+private:
+  struct slot {
+    file_infos infos;
+    std::vector<db_record> members;
+    bool done = false;
+  };
+
+  const std::size_t m_count;
+  std::vector<slot> m_slots;
+  std::mutex m_mutex;
+  std::condition_variable m_producers;
+  std::condition_variable m_consumer;
+  std::size_t m_next = 0;
+  bool m_cancelled = false;
+  std::exception_ptr m_error;
+};
@@ -0,0 +1,159 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <winpp/win.hpp>
+#include <psapi.h>
+#include "alloc-tracking.hpp"
+
+// counters of the process attributed to each phase of a run and to each hashing thread
+// - cycles of the processors, cpu time, page faults and read operations
+// - heap allocations when they are tracked (alloc-tracking.hpp)
+// - disabled by default: taking the counters costs a few system calls per phase
+namespace perf_counters {
+
+  // counters at one point in time (cumulative)
+  struct sample {
+    std::chrono::steady_clock::time_point wall;
+    std::uint64_t cycles = 0;
+    std::uint64_t cpu_us = 0;
+    std::uint64_t page_faults = 0;
+    std::uint64_t reads = 0;
+    std::uint64_t read_bytes = 0;
+    alloc_tracking::stats heap;
+  };
+
+  // difference between two samples
+  struct counters {
+    std::string name;
+    double seconds = 0;
+    std::uint64_t cycles = 0;
+    std::uint64_t cpu_us = 0;
+    std::uint64_t page_faults = 0;
+    std::uint64_t reads = 0;
+    std::uint64_t read_bytes = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t allocated_bytes = 0;
+    std::uint64_t peak_heap = 0;
+  };
+
+  inline std::uint64_t to_us(const FILETIME& t)
+  {
+    return ((static_cast<std::uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 10;
+  }
+
+  // counters of the whole process
+  inline sample process_sample()
+  {
+    sample s;
+    s.wall = std::chrono::steady_clock::now();
+    const HANDLE process = GetCurrentProcess();
+    ULONG64 cycles = 0;
+    if (QueryProcessCycleTime(process, &cycles))
+      s.cycles = cycles;
+    FILETIME creation, exit, kernel, user;
+    if (GetProcessTimes(process, &creation, &exit, &kernel, &user))
+      s.cpu_us = to_us(kernel) + to_us(user);
+    PROCESS_MEMORY_COUNTERS memory = {};
+    if (GetProcessMemoryInfo(process, &memory, sizeof(memory)))
+      s.page_faults = memory.PageFaultCount;
+    IO_COUNTERS io = {};
+    if (GetProcessIoCounters(process, &io))
+    {
+      s.reads = io.ReadOperationCount;
+      s.read_bytes = io.ReadTransferCount;
+    }
+    s.heap = alloc_tracking::process_stats();
+    return s;
+  }
+
+  // counters of the calling thread since its start
+  inline counters thread_counters(const std::string& name)
+  {
+    counters c;
+    c.name = name;
+    const HANDLE thread = GetCurrentThread();
+    ULONG64 cycles = 0;
+    if (QueryThreadCycleTime(thread, &cycles))
+      c.cycles = cycles;
+    FILETIME creation, exit, kernel, user;
+    if (GetThreadTimes(thread, &creation, &exit, &kernel, &user))
+      c.cpu_us = to_us(kernel) + to_us(user);
+    const alloc_tracking::stats& heap = alloc_tracking::thread_stats();
+    c.allocations = heap.allocations;
+    c.allocated_bytes = heap.bytes;
+    return c;
+  }
+
+  // counters of all the phases and threads of a run
+  class report {
+  public:
+    void enable()
+    {
+      m_enabled = true;
+    }
+
+    bool enabled() const
+    {
+      return m_enabled;
+    }
+
+    // start of a phase
+    sample begin() const
+    {
+      if (!m_enabled)
+        return sample();
+      alloc_tracking::reset_peak();
+      return process_sample();
+    }
+
+    // end of a phase
+    void end(const std::string& name, const sample& start)
+    {
+      if (!m_enabled)
+        return;
+      const sample& s = process_sample();
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_phases.push_back({ name,
+                           std::chrono::duration<double>(s.wall - start.wall).count(),
+                           s.cycles - start.cycles,
+                           s.cpu_us - start.cpu_us,
+                           s.page_faults - start.page_faults,
+                           s.reads - start.reads,
+                           s.read_bytes - start.read_bytes,
+                           s.heap.allocations - start.heap.allocations,
+                           s.heap.bytes - start.heap.bytes,
+                           alloc_tracking::peak() });
+    }
+
+    // counters of a thread at its end
+    void add_thread(counters&& c)
+    {
+      if (!m_enabled)
+        return;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_threads.push_back(std::move(c));
+    }
+
+    const std::vector<counters>& phases() const
+    {
+      return m_phases;
+    }
+
+    const std::vector<counters>& threads() const
+    {
+      return m_threads;
+    }
+
+  private:
+    bool m_enabled = false;
+    std::mutex m_mutex;
+    std::vector<counters> m_phases;
+    std::vector<counters> m_threads;
+  };
+
+  // counters of the run (enabled by the command line)
+  inline report g_report;
+}
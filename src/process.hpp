@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/utf8.hpp>
+#include <winpp/win.hpp>
+
+namespace process {
+
+  // start a new instance of this program with some command-line arguments
+  inline PROCESS_INFORMATION spawn_self(const std::string& args)
+  {
+    wchar_t exe[MAX_PATH];
+    if (GetModuleFileNameW(nullptr, exe, MAX_PATH) == 0)
+      throw std::runtime_error("can't retrieve the executable path");
+    std::wstring cmd = L"\"" + std::wstring(exe) + L"\" " + utf8::from_utf8(args);
+
+    STARTUPINFOW si = {};
+    si.cb = sizeof(si);
+    PROCESS_INFORMATION pi = {};
+    if (!CreateProcessW(exe, cmd.data(), nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi))
+      throw std::runtime_error(fmt::format("can't start worker process: {}", GetLastError()));
+    CloseHandle(pi.hThread);
+    return pi;
+  }
+
+  // wait for the end of processes - kill them first if requested
+  inline void wait_all(std::vector<PROCESS_INFORMATION>& processes, const bool kill = false)
+  {
+    for (auto& pi : processes)
+    {
+      if (kill)
+        TerminateProcess(pi.hProcess, 1);
+      WaitForSingleObject(pi.hProcess, INFINITE);
+      CloseHandle(pi.hProcess);
+    }
+    processes.clear();
+  }
+}
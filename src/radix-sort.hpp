@@ -0,0 +1,214 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include <array>
+#include <numeric>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include "cpu-limits.hpp"
+
+// parallel msd radix sort of a permutation by byte keys
+// - key(i) returns the key of the element i as a std::string_view
+// - keys are compared as unsigned bytes (same order as std::string)
+// - the sort is stable: equal keys keep the order of their indexes
+// - the first byte is distributed by all the threads, then each bucket is sorted
+//   by one thread (biggest buckets first); bytes shared by a whole bucket are skipped
+namespace radix_sort {
+
+  // buckets smaller than this are sorted by comparison
+  constexpr std::size_t small_bucket = 64;
+
+  // number of buckets: one for the keys ending at this depth + one per byte value
+  constexpr std::size_t nb_buckets = 257;
+
+  // bucket of a key at a depth (0: key ended)
+  inline std::size_t bucket(const std::string_view& key, const std::size_t depth)
+  {
+    return depth < key.size() ? static_cast<std::uint8_t>(key[depth]) + 1 : 0;
+  }
+
+  // sort a range of the permutation from a depth - tmp has the same size
+  template<typename Key>
+  void sort_range(std::uint32_t* idx,
+                  std::uint32_t* tmp,
+                  std::size_t count,
+                  std::size_t depth,
+                  Key& key)
+  {
+    while (count > small_bucket)
+    {
+      // count the keys of each bucket
+      std::array<std::size_t, nb_buckets> counts = {};
+      for (std::size_t i = 0; i < count; ++i)
+        ++counts[bucket(key(idx[i]), depth)];
+
+      // byte shared by all the keys: move to the next one without moving the keys
+      if (counts[0] == count)
+        return;
+      const auto single = std::find(counts.begin(), counts.end(), count);
+      if (single != counts.end())
+      {
+        ++depth;
+        continue;
+      }
+
+      // distribute the keys
+      std::array<std::size_t, nb_buckets> offsets;
+      std::size_t offset = 0;
+      for (std::size_t b = 0; b < nb_buckets; ++b)
+      {
+        offsets[b] = offset;
+        offset += counts[b];
+      }
+      for (std::size_t i = 0; i < count; ++i)
+        tmp[offsets[bucket(key(idx[i]), depth)]++] = idx[i];
+      std::memcpy(idx, tmp, count * sizeof(std::uint32_t));
+
+      // sort each bucket on the next byte (the ended keys are all equal)
+      offset = counts[0];
+      for (std::size_t b = 1; b < nb_buckets; ++b)
+      {
+        if (counts[b] > 1)
+          sort_range(idx + offset, tmp + offset, counts[b], depth + 1, key);
+        offset += counts[b];
+      }
+      return;
+    }
+
+    // small bucket: sort by comparison of the remaining bytes
+    std::stable_sort(idx, idx + count, [&](const std::uint32_t a, const std::uint32_t b) {
+      const std::string_view& ka = key(a);
+      const std::string_view& kb = key(b);
+      return ka.substr(std::min(depth, ka.size())) < kb.substr(std::min(depth, kb.size()));
+      });
+  }
+
+  // sort the permutation [0, count) by key
+  template<typename Key>
+  std::vector<std::uint32_t> order(const std::size_t count,
+                                   Key key,
+                                   const std::size_t nb_threads = cpu_limits::available())
+  {
+    std::vector<std::uint32_t> idx(count);
+    std::vector<std::uint32_t> tmp(count);
+    const std::size_t nb = std::max<std::size_t>(1, std::min(nb_threads, count / (small_bucket * 16)));
+    const std::size_t chunk = (count + nb - 1) / std::max<std::size_t>(1, nb);
+    auto parallel = [&](auto fct) {
+      std::vector<std::thread> threads;
+      for (std::size_t t = 1; t < nb; ++t)
+        threads.emplace_back(fct, t);
+      fct(0);
+      for (auto& t : threads)
+        t.join();
+    };
+
+    // common prefix of all the keys: skipped by the first distribution
+    std::vector<std::size_t> prefixes(nb, 0);
+    const std::string_view& first = count > 0 ? key(0) : std::string_view();
+    parallel([&](const std::size_t t) {
+      std::size_t prefix = first.size();
+      for (std::size_t i = t * chunk; i < std::min(count, (t + 1) * chunk) && prefix > 0; ++i)
+      {
+        const std::string_view& k = key(static_cast<std::uint32_t>(i));
+        std::size_t p = 0;
+        const std::size_t max = std::min(prefix, k.size());
+        while (p < max && k[p] == first[p])
+          ++p;
+        prefix = p;
+      }
+      prefixes[t] = prefix;
+      });
+    const std::size_t depth = count > 0 ? *std::min_element(prefixes.begin(), prefixes.end()) : 0;
+
+    // distribute the first byte: one histogram per thread
+    std::vector<std::array<std::size_t, nb_buckets>> counts(nb);
+    parallel([&](const std::size_t t) {
+      counts[t].fill(0);
+      for (std::size_t i = t * chunk; i < std::min(count, (t + 1) * chunk); ++i)
+        ++counts[t][bucket(key(static_cast<std::uint32_t>(i)), depth)];
+      });
+    std::array<std::size_t, nb_buckets> sizes = {};
+    std::vector<std::array<std::size_t, nb_buckets>> offsets(nb);
+    std::size_t offset = 0;
+    for (std::size_t b = 0; b < nb_buckets; ++b)
+    {
+      for (std::size_t t = 0; t < nb; ++t)
+      {
+        offsets[t][b] = offset;
+        offset += counts[t][b];
+        sizes[b] += counts[t][b];
+      }
+    }
+    parallel([&](const std::size_t t) {
+      auto& o = offsets[t];
+      for (std::size_t i = t * chunk; i < std::min(count, (t + 1) * chunk); ++i)
+        idx[o[bucket(key(static_cast<std::uint32_t>(i)), depth)]++] = static_cast<std::uint32_t>(i);
+      });
+
+    // sort the buckets in parallel - biggest first
+    struct range {
+      std::size_t begin;
+      std::size_t size;
+    };
+    std::vector<range> ranges;
+    offset = sizes[0];
+    for (std::size_t b = 1; b < nb_buckets; ++b)
+    {
+      if (sizes[b] > 1)
+        ranges.push_back({ offset, sizes[b] });
+      offset += sizes[b];
+    }
+    std::sort(ranges.begin(), ranges.end(), [](const range& a, const range& b) {
+      return a.size > b.size;
+      });
+    std::mutex mutex;
+    std::size_t next = 0;
+    parallel([&](const std::size_t) {
+      while (true)
+      {
+        range r;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (next >= ranges.size())
+            break;
+          r = ranges[next++];
+        }
+        sort_range(idx.data() + r.begin, tmp.data() + r.begin, r.size, depth + 1, key);
+      }
+      });
+    return idx;
+  }
+
+  // sort the permutation [0, count) by an unsigned integer value
+  template<typename Value>
+  std::vector<std::uint32_t> order_by_value(const std::size_t count,
+                                            Value value,
+                                            const std::size_t nb_threads = cpu_limits::available())
+  {
+    // big-endian keys: byte order is the numerical order
+    std::vector<std::array<char, sizeof(std::uint64_t)>> keys(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const std::uint64_t v = value(static_cast<std::uint32_t>(i));
+      for (std::size_t b = 0; b < sizeof(std::uint64_t); ++b)
+        keys[i][b] = static_cast<char>(v >> (8 * (sizeof(std::uint64_t) - 1 - b)));
+    }
+    return order(count, [&](const std::uint32_t i) {
+      return std::string_view(keys[i].data(), keys[i].size());
+      }, nb_threads);
+  }
+
+  // reorder a vector following a permutation
+  template<typename T>
+  void permute(std::vector<T>& v, const std::vector<std::uint32_t>& order)
+  {
+    std::vector<T> sorted;
+    sorted.reserve(v.size());
+    for (const auto i : order)
+      sorted.push_back(std::move(v[i]));
+    v = std::move(sorted);
+  }
+}
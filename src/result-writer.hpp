@@ -0,0 +1,106 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "database.hpp"
+
+// number of results accumulated by the consumer thread before handing them to the writer
+constexpr std::size_t g_shard_size = 1024;
+
+// writer of results running in its own thread
+// - the consumer thread (ordered results) pushes shards (batches) of results and never waits
+//   for the output
+// - derived classes implement the output format
+class result_writer {
+public:
+  result_writer() = default;
+  virtual ~result_writer() = default;
+  result_writer(const result_writer&) = delete;
+  result_writer& operator=(const result_writer&) = delete;
+
+  // hand a shard of results to the writer thread
+  void push(std::vector<db_record>&& shard)
+  {
+    if (shard.empty())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_shards.push_back(std::move(shard));
+    }
+    m_cv.notify_one();
+  }
+
+  // wait for all the results to be written and finalize the output
+  void close()
+  {
+    stop();
+    if (m_error)
+      std::rethrow_exception(m_error);
+    finish();
+  }
+
+protected:
+  // start the writer thread - must be called by the derived constructor once ready
+  void start()
+  {
+    m_thread = std::thread([this]() { run(); });
+  }
+
+  // write one result
+  virtual void write(const db_record& record) = 0;
+
+  // finalize the output once all results are written
+  virtual void finish() = 0;
+
+  // stop the writer thread - must be called by the derived destructor
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done = true;
+    }
+    m_cv.notify_one();
+    if (m_thread.joinable())
+      m_thread.join();
+  }
+
+private:
+  void run()
+  {
+    while (true)
+    {
+      std::vector<db_record> shard;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&]() { return !m_shards.empty() || m_done; });
+        if (m_shards.empty())
+          break;
+        shard = std::move(m_shards.front());
+        m_shards.pop_front();
+      }
+
+      // keep draining the queue after an error so the consumer never blocks
+      if (m_error)
+        continue;
+      try
+      {
+        for (const auto& r : shard)
+          write(r);
+      }
+      catch (...)
+      {
+        m_error = std::current_exception();
+      }
+    }
+  }
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::vector<db_record>> m_shards;
+  bool m_done = false;
+  std::exception_ptr m_error;
+};
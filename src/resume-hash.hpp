@@ -0,0 +1,112 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/files.hpp>
+#include "file-infos.hpp"
+#include "database.hpp"
+#include "sha256.hpp"
+
+// resumable hashing of files that only grow (logs, captures)
+// - the sha256 state after the last complete block is saved in the database with a
+//   fingerprint of the bytes before it
+// - if the file still starts with the same bytes, only the appended bytes are read
+namespace resume_hash {
+
+  // bytes before the saved state checked by the fingerprint
+  constexpr std::uint64_t tail_size = 4096;
+
+  // size of the read chunks (multiple of the block size)
+  constexpr std::size_t chunk_size = 1024 * 1024;
+
+  // saved state: 64 hex (state) + 16 hex (length) + 64 hex (fingerprint)
+  constexpr std::size_t state_len = 64 + 16 + 64;
+
+  inline std::string to_string(const sha256::midstate& m, const std::string& tail)
+  {
+    std::string s;
+    for (const std::uint32_t w : m.state)
+      s += fmt::format("{:08x}", w);
+    s += fmt::format("{:016x}", m.length);
+    return s + tail;
+  }
+
+  inline bool from_string(const std::string& s, sha256::midstate& m, std::string& tail)
+  {
+    if (s.size() != state_len || s.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+      return false;
+    for (std::size_t i = 0; i < m.state.size(); ++i)
+      m.state[i] = static_cast<std::uint32_t>(std::stoul(s.substr(8 * i, 8), nullptr, 16));
+    m.length = std::stoull(s.substr(64, 16), nullptr, 16);
+    tail = s.substr(80);
+    return m.length % 64 == 0;
+  }
+
+  // fingerprint of the bytes before a position
+  inline std::string fingerprint(std::ifstream& file, const std::uint64_t length)
+  {
+    const std::uint64_t start = length - std::min(length, tail_size);
+    std::vector<char> buffer(static_cast<std::size_t>(length - start));
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(start));
+    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (static_cast<std::size_t>(file.gcount()) != buffer.size())
+      return std::string();
+    sha256 hash;
+    hash.update(buffer.data(), buffer.size());
+    return hash.hex();
+  }
+
+  // retrieve infos for one file - resumed from the saved state of the previous run if valid
+  inline file_infos get_file_infos(const std::filesystem::path& path, const std::string& saved)
+  {
+    const struct stat& file_info = files::get_stat(path);
+    const std::uint64_t size = static_cast<std::uint64_t>(std::filesystem::file_size(path));
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.u8string()));
+
+    // the file must start with the bytes already hashed
+    sha256 hash;
+    sha256::midstate m;
+    std::string tail;
+    if (!saved.empty() && from_string(saved, m, tail) && m.length <= size && same_hash(fingerprint(file, m.length), tail))
+      hash = sha256(m);
+    else
+      m.length = 0;
+
+    // hash the new bytes up to the last complete block, save the state and finish the hash
+    std::vector<char> buffer(chunk_size);
+    const std::uint64_t aligned = size - size % 64;
+    if (m.length == aligned)
+      hash.save(m);
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(m.length));
+    for (std::uint64_t pos = m.length; pos < size;)
+    {
+      const std::uint64_t limit = pos < aligned ? aligned : size;
+      const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), limit - pos));
+      file.read(buffer.data(), static_cast<std::streamsize>(n));
+      if (static_cast<std::size_t>(file.gcount()) != n)
+        throw std::runtime_error(fmt::format("can't read file: \"{}\"", path.u8string()));
+      hash.update(buffer.data(), n);
+      pos += n;
+      if (pos == aligned)
+        hash.save(m);
+    }
+    const std::string& state = to_string(m, fingerprint(file, m.length));
+
+    return {
+      hash.hex(),
+      static_cast<uint64_t>(file_info.st_ctime),
+      static_cast<uint64_t>(file_info.st_mtime),
+      size,
+      state
+    };
+  }
+}
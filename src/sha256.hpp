@@ -0,0 +1,149 @@
+#pragma once
+#include <string>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "database.hpp"
+
+// incremental sha256 (fips 180-4) for the data read by the program itself
+class sha256 {
+public:
+  // intermediate state at a block boundary: hashing can be resumed from it
+  struct midstate {
+    std::array<std::uint32_t, 8> state;
+    std::uint64_t length;
+  };
+
+  sha256() = default;
+
+  // resume the hash of data from its intermediate state
+  explicit sha256(const midstate& m) :
+    m_state(m.state),
+    m_length(m.length)
+  {
+  }
+
+  // intermediate state - only available at a block boundary (length multiple of 64)
+  bool save(midstate& m) const
+  {
+    if (m_buffered != 0)
+      return false;
+    m = { m_state, m_length };
+    return true;
+  }
+
+  // hash a chunk of data
+  void update(const void* data, std::size_t len)
+  {
+    const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+    m_length += len;
+    if (m_buffered > 0)
+    {
+      const std::size_t n = std::min(len, m_buffer.size() - m_buffered);
+      std::memcpy(m_buffer.data() + m_buffered, p, n);
+      m_buffered += n;
+      p += n;
+      len -= n;
+      if (m_buffered < m_buffer.size())
+        return;
+      transform(m_buffer.data());
+      m_buffered = 0;
+    }
+    for (; len >= m_buffer.size(); p += m_buffer.size(), len -= m_buffer.size())
+      transform(p);
+    std::memcpy(m_buffer.data(), p, len);
+    m_buffered = len;
+  }
+
+  // finalize the hash and retrieve the digest
+  digest final()
+  {
+    const std::uint64_t bits = m_length * 8;
+    const std::uint8_t pad = 0x80;
+    update(&pad, 1);
+    const std::uint8_t zero = 0;
+    while (m_buffered != m_buffer.size() - sizeof(bits))
+      update(&zero, 1);
+    std::uint8_t len[sizeof(bits)];
+    for (std::size_t i = 0; i < sizeof(bits); ++i)
+      len[i] = static_cast<std::uint8_t>(bits >> (8 * (sizeof(bits) - 1 - i)));
+    update(len, sizeof(len));
+
+    digest d;
+    for (std::size_t i = 0; i < m_state.size(); ++i)
+      for (std::size_t j = 0; j < 4; ++j)
+        d[4 * i + j] = static_cast<std::uint8_t>(m_state[i] >> (24 - 8 * j));
+    return d;
+  }
+
+  // finalize the hash and retrieve the digest as hexadecimal string
+  std::string hex()
+  {
+    const digest& d = final();
+    return to_hex(d.data());
+  }
+
+private:
+  static std::uint32_t rotr(const std::uint32_t x, const int n)
+  {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  // process one block of 64 bytes
+  void transform(const std::uint8_t* block)
+  {
+    static constexpr std::uint32_t k[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+    std::uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+      w[i] = (static_cast<std::uint32_t>(block[4 * i]) << 24) |
+             (static_cast<std::uint32_t>(block[4 * i + 1]) << 16) |
+             (static_cast<std::uint32_t>(block[4 * i + 2]) << 8) |
+             static_cast<std::uint32_t>(block[4 * i + 3]);
+    for (int i = 16; i < 64; ++i)
+    {
+      const std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    std::uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    std::uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+      const std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      const std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+    m_state[4] += e;
+    m_state[5] += f;
+    m_state[6] += g;
+    m_state[7] += h;
+  }
+
+  std::array<std::uint32_t, 8> m_state = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  std::array<std::uint8_t, 64> m_buffer = {};
+  std::size_t m_buffered = 0;
+  std::uint64_t m_length = 0;
+};
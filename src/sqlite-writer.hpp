@@ -0,0 +1,123 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <sqlite3.h>
+#include "result-writer.hpp"
+
+// bulk load of the results into a sqlite database
+// - one transaction for the whole load with a prepared statement
+// - wal journal without synchronization during the load
+// - indexes are created once all the rows are inserted
+// - loaded in a temporary database renamed at the end: a failed scan keeps the previous output
+class sqlite_writer : public result_writer {
+public:
+  explicit sqlite_writer(const std::filesystem::path& path) :
+    m_path(path),
+    m_tmp(std::filesystem::path(path) += ".tmp")
+  {
+    remove_database(m_tmp);
+    if (sqlite3_open(m_tmp.u8string().c_str(), &m_db) != SQLITE_OK)
+    {
+      const std::string err = sqlite3_errmsg(m_db);
+      sqlite3_close(m_db);
+      throw std::runtime_error(fmt::format("can't open sqlite database: {}", err));
+    }
+    try
+    {
+      exec("PRAGMA journal_mode = WAL");
+      exec("PRAGMA synchronous = OFF");
+      exec("PRAGMA temp_store = MEMORY");
+      exec("PRAGMA cache_size = -262144");
+      exec("CREATE TABLE files ("
+           "name TEXT NOT NULL, "
+           "sha TEXT NOT NULL, "
+           "ctime INTEGER NOT NULL, "
+           "mtime INTEGER NOT NULL, "
+           "size INTEGER NOT NULL)");
+      exec("BEGIN TRANSACTION");
+      if (sqlite3_prepare_v2(m_db, "INSERT INTO files VALUES (?, ?, ?, ?, ?)", -1, &m_insert, nullptr) != SQLITE_OK)
+        throw std::runtime_error(fmt::format("sqlite error: {}", sqlite3_errmsg(m_db)));
+    }
+    catch (...)
+    {
+      if (m_insert)
+        sqlite3_finalize(m_insert);
+      sqlite3_close(m_db);
+      remove_database(m_tmp);
+      throw;
+    }
+    start();
+  }
+
+  ~sqlite_writer()
+  {
+    stop();
+    if (m_insert)
+      sqlite3_finalize(m_insert);
+    sqlite3_close(m_db);
+
+    // unfinished load: the previous database is kept
+    if (m_db)
+      remove_database(m_tmp);
+  }
+
+protected:
+  void write(const db_record& record) override
+  {
+    const auto& [name, infos] = record;
+    sqlite3_bind_text(m_insert, 1, name.c_str(), static_cast<int>(name.size()), SQLITE_STATIC);
+    sqlite3_bind_text(m_insert, 2, infos.sha.c_str(), static_cast<int>(infos.sha.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(m_insert, 3, static_cast<sqlite3_int64>(infos.ctime));
+    sqlite3_bind_int64(m_insert, 4, static_cast<sqlite3_int64>(infos.mtime));
+    sqlite3_bind_int64(m_insert, 5, static_cast<sqlite3_int64>(infos.size));
+    if (sqlite3_step(m_insert) != SQLITE_DONE)
+      throw std::runtime_error(fmt::format("sqlite error: {}", sqlite3_errmsg(m_db)));
+    sqlite3_reset(m_insert);
+  }
+
+  void finish() override
+  {
+    sqlite3_finalize(m_insert);
+    m_insert = nullptr;
+    exec("COMMIT");
+    exec("CREATE UNIQUE INDEX files_name ON files (name)");
+    exec("CREATE INDEX files_sha ON files (sha)");
+    exec("CREATE INDEX files_mtime ON files (mtime)");
+
+    // leave a single self-contained file in place of the previous database
+    exec("PRAGMA wal_checkpoint(TRUNCATE)");
+    exec("PRAGMA journal_mode = DELETE");
+    if (sqlite3_close(m_db) != SQLITE_OK)
+      throw std::runtime_error(fmt::format("sqlite error: {}", sqlite3_errmsg(m_db)));
+    m_db = nullptr;
+    remove_database(m_path);
+    std::filesystem::rename(m_tmp, m_path);
+  }
+
+private:
+  // remove a database and its journals (left by a crashed run)
+  static void remove_database(const std::filesystem::path& path)
+  {
+    std::error_code ec;
+    for (const char* suffix : { "", "-wal", "-shm", "-journal" })
+      std::filesystem::remove(std::filesystem::path(path) += suffix, ec);
+  }
+
+  void exec(const char* sql)
+  {
+    char* err = nullptr;
+    if (sqlite3_exec(m_db, sql, nullptr, nullptr, &err) != SQLITE_OK)
+    {
+      const std::string msg = err ? err : "unknown error";
+      sqlite3_free(err);
+      throw std::runtime_error(fmt::format("sqlite error: {}", msg));
+    }
+  }
+
+  const std::filesystem::path m_path;
+  const std::filesystem::path m_tmp;
+  sqlite3* m_db = nullptr;
+  sqlite3_stmt* m_insert = nullptr;
+};
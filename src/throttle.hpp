@@ -0,0 +1,252 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/win.hpp>
+#include <pdh.h>
+
+// backoff of the hashing threads when the system is busy (shared servers)
+// - the load of the system is sampled every second: processors and disks used by the other
+//   processes (the scan alone never throttles itself), and memory
+// - above a threshold, the number of running threads is halved (down to a pause),
+//   it grows again by one thread per sample once the system is idle
+namespace throttle {
+
+  // thresholds in percent (0: not monitored)
+  struct thresholds {
+    unsigned cpu = 0;
+    unsigned memory = 0;
+    unsigned io = 0;
+
+    bool enabled() const
+    {
+      return cpu > 0 || memory > 0 || io > 0;
+    }
+  };
+
+  // parse the thresholds: "cpu=80,memory=90,io=70"
+  inline thresholds parse(const std::string& str)
+  {
+    thresholds t;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+      const std::size_t equal = item.find('=');
+      if (equal == std::string::npos)
+        throw std::runtime_error(fmt::format("invalid throttle threshold: \"{}\"", item));
+      const std::string& key = item.substr(0, equal);
+      const unsigned value = static_cast<unsigned>(std::stoul(item.substr(equal + 1)));
+      if (value > 100)
+        throw std::runtime_error(fmt::format("invalid throttle threshold: \"{}\"", item));
+      if (key == "cpu")
+        t.cpu = value;
+      else if (key == "memory")
+        t.memory = value;
+      else if (key == "io")
+        t.io = value;
+      else
+        throw std::runtime_error(fmt::format("unknown throttle resource: \"{}\"", key));
+    }
+    return t;
+  }
+
+  // load of the system in percent
+  class sampler {
+  public:
+    sampler()
+    {
+      // busy time and transfers of all the disks (performance counters)
+      if (PdhOpenQueryW(nullptr, 0, &m_query) == ERROR_SUCCESS &&
+          PdhAddEnglishCounterW(m_query, L"\\PhysicalDisk(_Total)\\% Idle Time", 0, &m_disk_idle) == ERROR_SUCCESS &&
+          PdhAddEnglishCounterW(m_query, L"\\PhysicalDisk(_Total)\\Disk Bytes/sec", 0, &m_disk_bytes) == ERROR_SUCCESS)
+        PdhCollectQueryData(m_query);
+      else
+        m_disk_idle = nullptr;
+      cpu();
+      self_io();
+    }
+
+    ~sampler()
+    {
+      if (m_query)
+        PdhCloseQuery(m_query);
+    }
+    sampler(const sampler&) = delete;
+    sampler& operator=(const sampler&) = delete;
+
+    // busy time of the processors used by the other processes since the previous call
+    unsigned cpu()
+    {
+      FILETIME idle, kernel, user, creation, exit, self_kernel, self_user;
+      if (!GetSystemTimes(&idle, &kernel, &user) ||
+          !GetProcessTimes(GetCurrentProcess(), &creation, &exit, &self_kernel, &self_user))
+        return 0;
+      auto to_u64 = [](const FILETIME& t) {
+        return (static_cast<std::uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+      };
+      const std::uint64_t i = to_u64(idle);
+      const std::uint64_t total = to_u64(kernel) + to_u64(user);   // kernel time includes idle time
+      const std::uint64_t self = to_u64(self_kernel) + to_u64(self_user);
+      const std::uint64_t d_total = total - m_total;
+      const std::uint64_t d_busy = d_total - std::min(i - m_idle, d_total);
+      const std::uint64_t d_self = self - m_self;
+      m_idle = i;
+      m_total = total;
+      m_self = self;
+      return d_total > 0 ? static_cast<unsigned>(100 * (d_busy - std::min(d_self, d_busy)) / d_total) : 0;
+    }
+
+    unsigned memory()
+    {
+      MEMORYSTATUSEX status = {};
+      status.dwLength = sizeof(status);
+      return GlobalMemoryStatusEx(&status) ? static_cast<unsigned>(status.dwMemoryLoad) : 0;
+    }
+
+    // busy time of the disks used by the other processes since the previous call
+    // - the busy time is shared in proportion of the bytes transferred: the reads and writes
+    //   of the scan are removed from the bytes of the disks (its reads served by the cache
+    //   too: the load of the others is underestimated rather than the scan throttling itself)
+    unsigned io()
+    {
+      const double self = self_io();
+      PDH_FMT_COUNTERVALUE idle, bytes;
+      if (!m_disk_idle ||
+          PdhCollectQueryData(m_query) != ERROR_SUCCESS ||
+          PdhGetFormattedCounterValue(m_disk_idle, PDH_FMT_DOUBLE, nullptr, &idle) != ERROR_SUCCESS ||
+          PdhGetFormattedCounterValue(m_disk_bytes, PDH_FMT_DOUBLE, nullptr, &bytes) != ERROR_SUCCESS)
+        return 0;
+      const double busy = 100.0 - std::clamp(idle.doubleValue, 0.0, 100.0);
+      const double others = bytes.doubleValue > 0 ? std::clamp((bytes.doubleValue - self) / bytes.doubleValue, 0.0, 1.0) : 1.0;
+      return static_cast<unsigned>(busy * others);
+    }
+
+  private:
+    // bytes per second read and written by this process since the previous call
+    double self_io()
+    {
+      IO_COUNTERS counters = {};
+      if (!GetProcessIoCounters(GetCurrentProcess(), &counters))
+        return 0;
+      const std::uint64_t bytes = counters.ReadTransferCount + counters.WriteTransferCount;
+      const auto now = std::chrono::steady_clock::now();
+      const double seconds = std::chrono::duration<double>(now - m_io_time).count();
+      const double rate = seconds > 0 ? static_cast<double>(bytes - m_io_bytes) / seconds : 0;
+      m_io_bytes = bytes;
+      m_io_time = now;
+      return rate;
+    }
+
+    PDH_HQUERY m_query = nullptr;
+    PDH_HCOUNTER m_disk_idle = nullptr;
+    PDH_HCOUNTER m_disk_bytes = nullptr;
+    std::uint64_t m_idle = 0;
+    std::uint64_t m_total = 0;
+    std::uint64_t m_self = 0;
+    std::uint64_t m_io_bytes = 0;
+    std::chrono::steady_clock::time_point m_io_time = std::chrono::steady_clock::now();
+  };
+
+  // number of threads allowed to run, adjusted by a monitoring thread
+  class pool {
+  public:
+    pool(const thresholds& limits, const std::size_t nb_threads) :
+      m_limits(limits),
+      m_max(nb_threads),
+      m_allowed(nb_threads)
+    {
+      if (m_limits.enabled())
+        m_monitor = std::thread([this]() { monitor(); });
+    }
+
+    ~pool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_cv.notify_all();
+      if (m_monitor.joinable())
+        m_monitor.join();
+    }
+    pool(const pool&) = delete;
+    pool& operator=(const pool&) = delete;
+
+    // thread: wait until it is allowed to run - false once all the work is handed out
+    bool wait(const std::size_t thread_index)
+    {
+      if (!m_limits.enabled())
+        return true;
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [&]() { return thread_index < m_allowed || m_finished; });
+      return !m_finished;
+    }
+
+    // no work left: release the paused threads
+    void finish()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+      }
+      m_cv.notify_all();
+    }
+
+    // number of times the threads have been reduced
+    std::size_t backoffs()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_backoffs;
+    }
+
+  private:
+    void monitor()
+    {
+      sampler load;
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (!m_cv.wait_for(lock, std::chrono::seconds(1), [&]() { return m_stop; }))
+      {
+        lock.unlock();
+        const unsigned cpu = load.cpu();
+        const unsigned memory = load.memory();
+        const unsigned io = load.io();
+        lock.lock();
+
+        // pressure: shrink the pool - idle (20% below all thresholds): grow it
+        auto over = [](const unsigned value, const unsigned limit, const unsigned percent) {
+          return limit > 0 && value * 100 >= limit * percent;
+        };
+        if (over(cpu, m_limits.cpu, 100) || over(memory, m_limits.memory, 100) || over(io, m_limits.io, 100))
+        {
+          if (m_allowed > 0)
+            ++m_backoffs;
+          m_allowed /= 2;
+        }
+        else if (!over(cpu, m_limits.cpu, 80) && !over(memory, m_limits.memory, 80) && !over(io, m_limits.io, 80) &&
+                 m_allowed < m_max)
+        {
+          ++m_allowed;
+          m_cv.notify_all();
+        }
+      }
+    }
+
+    const thresholds m_limits;
+    const std::size_t m_max;
+    std::size_t m_allowed;
+    std::size_t m_backoffs = 0;
+    bool m_stop = false;
+    bool m_finished = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_monitor;
+  };
+}
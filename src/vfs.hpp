@@ -0,0 +1,524 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <winpp/files.hpp>
+#include "file-infos.hpp"
+#include "enumerate.hpp"
+#include "sha256.hpp"
+
+// file system used by the extraction of infos: enumerate, stat, open, read and set times
+// - native: the files of the disk (same calls as without this layer)
+// - simulated: a tree generated from a seed with the latency, jitter and errors of each
+//   operation, to benchmark at any scale without the disk (network shares, 100M files)
+namespace vfs {
+
+  // one entry of a directory
+  struct dir_entry {
+    std::string name;
+    bool directory = false;
+  };
+
+  // stream of the content of a file
+  class reader {
+  public:
+    virtual ~reader() = default;
+
+    // read up to size bytes - returns 0 at the end of the file
+    virtual std::size_t read(char* data, const std::size_t size) = 0;
+  };
+
+  class backend {
+  public:
+    virtual ~backend() = default;
+
+    virtual std::vector<dir_entry> list(const std::filesystem::path& dir) = 0;
+    virtual file_infos stat(const std::filesystem::path& file) = 0;
+    virtual std::unique_ptr<reader> open(const std::filesystem::path& file) = 0;
+
+    // set the creation and modification times (0: unchanged)
+    virtual bool set_times(const std::filesystem::path& file, const std::uint64_t ctime, const std::uint64_t mtime) = 0;
+
+    // statistics of the operations (empty if not relevant)
+    virtual std::string summary() const
+    {
+      return std::string();
+    }
+
+    // all the files of a tree sorted by full path (same order as enumerate::sorted_files)
+    virtual std::vector<std::filesystem::path> sorted_files(const std::filesystem::path& root)
+    {
+      std::vector<std::filesystem::path> files;
+      walk(root, files);
+      return files;
+    }
+
+    // infos of one file: stat and sha256 of its content
+    virtual file_infos get_file_infos(const std::filesystem::path& file)
+    {
+      file_infos infos = stat(file);
+      const std::unique_ptr<reader>& r = open(file);
+      std::vector<char> buffer(1024 * 1024);
+      sha256 hash;
+      while (const std::size_t n = r->read(buffer.data(), buffer.size()))
+        hash.update(buffer.data(), n);
+      infos.sha = hash.hex();
+      return infos;
+    }
+
+  private:
+    void walk(const std::filesystem::path& dir, std::vector<std::filesystem::path>& files)
+    {
+      // sort key: name, followed by '\' for directories (separator of their content)
+      std::vector<std::pair<std::string, bool>> children;
+      for (auto& e : list(dir))
+      {
+        if (!e.directory)
+          children.emplace_back(std::move(e.name), false);
+        else if (e.name.rfind(".", 0) != 0)
+          children.emplace_back(e.name + '\\', true);
+      }
+      std::sort(children.begin(), children.end());
+      for (auto& [key, directory] : children)
+      {
+        if (directory)
+        {
+          key.pop_back();
+          walk(dir / std::filesystem::u8path(key), files);
+        }
+        else
+          files.push_back(dir / std::filesystem::u8path(key));
+      }
+    }
+  };
+
+  // files of the disk
+  class native : public backend {
+  public:
+    std::vector<dir_entry> list(const std::filesystem::path& dir) override
+    {
+      std::vector<dir_entry> entries;
+      for (const auto& e : std::filesystem::directory_iterator(dir))
+      {
+        if (e.is_directory() && !e.is_symlink())
+          entries.push_back({ e.path().filename().u8string(), true });
+        else if (e.is_regular_file())
+          entries.push_back({ e.path().filename().u8string(), false });
+      }
+      return entries;
+    }
+
+    file_infos stat(const std::filesystem::path& file) override
+    {
+      const struct stat& file_info = files::get_stat(file);
+      file_infos infos;
+      infos.ctime = static_cast<std::uint64_t>(file_info.st_ctime);
+      infos.mtime = static_cast<std::uint64_t>(file_info.st_mtime);
+      infos.size = static_cast<std::uint64_t>(std::filesystem::file_size(file));
+      return infos;
+    }
+
+    std::unique_ptr<reader> open(const std::filesystem::path& file) override
+    {
+      class file_reader : public reader {
+      public:
+        explicit file_reader(const std::filesystem::path& path) :
+          m_file(path, std::ios::binary)
+        {
+          if (!m_file.good())
+            throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.u8string()));
+        }
+
+        std::size_t read(char* data, const std::size_t size) override
+        {
+          m_file.read(data, static_cast<std::streamsize>(size));
+          return static_cast<std::size_t>(m_file.gcount());
+        }
+
+      private:
+        std::ifstream m_file;
+      };
+      return std::make_unique<file_reader>(file);
+    }
+
+    bool set_times(const std::filesystem::path& file, const std::uint64_t ctime, const std::uint64_t mtime) override
+    {
+      return files::set_stat(file, ctime, 0, mtime);
+    }
+
+    // the enumeration and the hash of the disk are already optimized
+    std::vector<std::filesystem::path> sorted_files(const std::filesystem::path& root) override
+    {
+      return enumerate::sorted_files(root);
+    }
+
+    file_infos get_file_infos(const std::filesystem::path& file) override
+    {
+      return ::get_file_infos(file);
+    }
+  };
+
+  // parameters of the simulated tree
+  // - each directory has files_per_dir files and dirs_per_dir sub-directories (up to depth)
+  // - the sizes are spread between 0.5 and 1.5 times the mean size
+  // - latency of each operation plus a random jitter in [0, jitter]
+  // - errors: probability of failure of each operation (like a disk error: the first one aborts
+  //   the scan, to test the error paths rather than to measure a degraded run)
+  // - duplicates: probability that a file has the content of one of 16 shared contents
+  struct config {
+    std::size_t files_per_dir = 100;
+    std::size_t dirs_per_dir = 10;
+    std::size_t depth = 2;
+    std::uint64_t size = 64 * 1024;
+    std::chrono::microseconds list_latency{ 0 };
+    std::chrono::microseconds stat_latency{ 0 };
+    std::chrono::microseconds open_latency{ 0 };
+    std::chrono::microseconds read_latency{ 0 };
+    std::chrono::microseconds jitter{ 0 };
+    double errors = 0;
+    double duplicates = 0;
+    bool zero = false;
+    std::uint64_t seed = 1;
+  };
+
+  // parse a duration: "250us", "2ms", "1s"
+  inline std::chrono::microseconds parse_duration(const std::string& str)
+  {
+    std::size_t end = 0;
+    const double value = std::stod(str, &end);
+    const std::string& unit = str.substr(end);
+    double us = value;
+    if (unit == "ms")
+      us = value * 1000;
+    else if (unit == "s")
+      us = value * 1000 * 1000;
+    else if (unit != "us")
+      throw std::runtime_error(fmt::format("invalid duration: \"{}\" (us, ms or s)", str));
+    return std::chrono::microseconds(static_cast<std::int64_t>(us));
+  }
+
+  // parse a size: "4096", "64k", "1m", "2g"
+  inline std::uint64_t parse_size(const std::string& str)
+  {
+    std::size_t end = 0;
+    const std::uint64_t value = std::stoull(str, &end);
+    const std::string& unit = str.substr(end);
+    if (unit.empty())
+      return value;
+    if (unit == "k")
+      return value << 10;
+    if (unit == "m")
+      return value << 20;
+    if (unit == "g")
+      return value << 30;
+    throw std::runtime_error(fmt::format("invalid size: \"{}\" (k, m or g)", str));
+  }
+
+  // parse the parameters: "files=100,dirs=10,depth=3,size=1m,open=2ms,read=1ms,jitter=500us,errors=0.001"
+  inline config parse(const std::string& str)
+  {
+    config c;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+      const std::size_t equal = item.find('=');
+      if (equal == std::string::npos)
+        throw std::runtime_error(fmt::format("invalid simulation parameter: \"{}\"", item));
+      const std::string& key = item.substr(0, equal);
+      const std::string& value = item.substr(equal + 1);
+      if (key == "files")
+        c.files_per_dir = static_cast<std::size_t>(std::stoull(value));
+      else if (key == "dirs")
+        c.dirs_per_dir = static_cast<std::size_t>(std::stoull(value));
+      else if (key == "depth")
+        c.depth = static_cast<std::size_t>(std::stoull(value));
+      else if (key == "size")
+        c.size = parse_size(value);
+      else if (key == "list")
+        c.list_latency = parse_duration(value);
+      else if (key == "stat")
+        c.stat_latency = parse_duration(value);
+      else if (key == "open")
+        c.open_latency = parse_duration(value);
+      else if (key == "read")
+        c.read_latency = parse_duration(value);
+      else if (key == "jitter")
+        c.jitter = parse_duration(value);
+      else if (key == "errors")
+        c.errors = std::stod(value);
+      else if (key == "duplicates")
+        c.duplicates = std::stod(value);
+      else if (key == "content")
+      {
+        if (value != "random" && value != "zero")
+          throw std::runtime_error(fmt::format("invalid simulated content: \"{}\" (random or zero)", value));
+        c.zero = value == "zero";
+      }
+      else if (key == "seed")
+        c.seed = std::stoull(value);
+      else
+        throw std::runtime_error(fmt::format("unknown simulation parameter: \"{}\"", key));
+    }
+    if (c.errors < 0 || c.errors > 1 || c.duplicates < 0 || c.duplicates > 1)
+      throw std::runtime_error("the simulated errors and duplicates are probabilities (0..1)");
+    return c;
+  }
+
+  // tree generated from the seed: the same parameters always give the same files
+  // - names: d<n> for the directories, f<n>.bin for the files
+  // - the times set on the files are kept in memory
+  class simulated : public backend {
+  public:
+    simulated(const std::filesystem::path& root, const config& c) :
+      m_config(c),
+      m_prefix(enumerate::prefix_length(root))
+    {
+    }
+
+    std::vector<dir_entry> list(const std::filesystem::path& dir) override
+    {
+      const node& n = resolve(dir);
+      operation(dir, n.key, op::list, 0);
+      if (n.file)
+        throw std::runtime_error(fmt::format("not a directory: \"{}\"", dir.u8string()));
+      std::vector<dir_entry> entries;
+      for (std::size_t i = 0; i < m_config.files_per_dir; ++i)
+        entries.push_back({ fmt::format("f{}.bin", i), false });
+      if (n.depth < m_config.depth)
+        for (std::size_t i = 0; i < m_config.dirs_per_dir; ++i)
+          entries.push_back({ fmt::format("d{}", i), true });
+      return entries;
+    }
+
+    file_infos stat(const std::filesystem::path& file) override
+    {
+      const node& n = resolve_file(file);
+      operation(file, n.key, op::stat, 0);
+
+      // times of the file: the last 3 years - overridden by set_times
+      const std::uint64_t h = mix(n.key ^ 0x7469'6d65);
+      file_infos infos;
+      infos.mtime = 1577836800 + h % (3 * 365 * 86400);
+      infos.ctime = infos.mtime - (h >> 32) % (30 * 86400);
+      infos.size = size(content_key(n.key));
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_times.find(file.u8string());
+        if (it != m_times.end())
+        {
+          if (it->second.first)
+            infos.ctime = it->second.first;
+          if (it->second.second)
+            infos.mtime = it->second.second;
+        }
+      }
+      return infos;
+    }
+
+    std::unique_ptr<reader> open(const std::filesystem::path& file) override
+    {
+      class generated_reader : public reader {
+      public:
+        generated_reader(simulated& fs, const std::filesystem::path& path, const std::uint64_t key, const std::uint64_t content) :
+          m_fs(fs),
+          m_path(path),
+          m_key(key),
+          m_content(content),
+          m_size(fs.size(content))
+        {
+        }
+
+        std::size_t read(char* data, const std::size_t size) override
+        {
+          if (m_pos >= m_size)
+            return 0;
+          m_fs.operation(m_path, m_key, op::read, m_pos);
+          const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(size, m_size - m_pos));
+          m_fs.generate(m_content, m_pos, data, n);
+          m_pos += n;
+          m_fs.m_read_bytes.fetch_add(n, std::memory_order_relaxed);
+          return n;
+        }
+
+      private:
+        simulated& m_fs;
+        const std::filesystem::path m_path;
+        const std::uint64_t m_key;
+        const std::uint64_t m_content;
+        const std::uint64_t m_size;
+        std::uint64_t m_pos = 0;
+      };
+      const node& n = resolve_file(file);
+      operation(file, n.key, op::open, 0);
+      return std::make_unique<generated_reader>(*this, file, n.key, content_key(n.key));
+    }
+
+    bool set_times(const std::filesystem::path& file, const std::uint64_t ctime, const std::uint64_t mtime) override
+    {
+      resolve_file(file);
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto& times = m_times[file.u8string()];
+      if (ctime)
+        times.first = ctime;
+      if (mtime)
+        times.second = mtime;
+      return true;
+    }
+
+    std::string summary() const override
+    {
+      return fmt::format("{} operation(s), {} byte(s) generated, {} injected error(s)",
+        m_operations.load(), m_read_bytes.load(), m_errors.load());
+    }
+
+  private:
+    enum class op : std::uint64_t { list = 1, stat, open, read };
+
+    // position of a path in the tree: key derived from the seed and the names
+    struct node {
+      std::uint64_t key = 0;
+      std::size_t depth = 0;
+      bool file = false;
+    };
+
+    // splitmix64: random values from a key
+    static std::uint64_t mix(std::uint64_t x)
+    {
+      x += 0x9e3779b97f4a7c15ULL;
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return x ^ (x >> 31);
+    }
+
+    // uniform value in [0, 1) from a key
+    static double unit(const std::uint64_t x)
+    {
+      return static_cast<double>(mix(x) >> 11) / static_cast<double>(1ULL << 53);
+    }
+
+    // index of a name "<prefix><n><suffix>" below count
+    static bool parse_index(const std::string& name, const char prefix, const std::string& suffix,
+                            const std::size_t count, std::size_t& index)
+    {
+      if (name.size() <= 1 + suffix.size() || name[0] != prefix ||
+          name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+        return false;
+      const std::string& digits = name.substr(1, name.size() - 1 - suffix.size());
+      if (digits.find_first_not_of("0123456789") != std::string::npos || (digits.size() > 1 && digits[0] == '0'))
+        return false;
+      index = static_cast<std::size_t>(std::stoull(digits));
+      return index < count;
+    }
+
+    node resolve(const std::filesystem::path& path) const
+    {
+      node n;
+      n.key = mix(m_config.seed);
+      const std::string& full = path.u8string();
+      if (full.size() + 1 < m_prefix)
+        throw std::runtime_error(fmt::format("not in the simulated tree: \"{}\"", full));
+      std::stringstream ss(full.size() >= m_prefix ? full.substr(m_prefix) : std::string());
+      std::string name;
+      while (std::getline(ss, name, '\\'))
+      {
+        std::size_t index = 0;
+        if (n.file)
+          throw std::runtime_error(fmt::format("no such file: \"{}\"", full));
+        if (n.depth < m_config.depth && parse_index(name, 'd', "", m_config.dirs_per_dir, index))
+          ++n.depth;
+        else if (parse_index(name, 'f', ".bin", m_config.files_per_dir, index))
+        {
+          n.file = true;
+          index += m_config.dirs_per_dir;
+        }
+        else
+          throw std::runtime_error(fmt::format("no such file: \"{}\"", full));
+        n.key = mix(n.key ^ (index + 1));
+      }
+      return n;
+    }
+
+    node resolve_file(const std::filesystem::path& file) const
+    {
+      const node& n = resolve(file);
+      if (!n.file)
+        throw std::runtime_error(fmt::format("not a file: \"{}\"", file.u8string()));
+      return n;
+    }
+
+    // content of a file: its own or one of the shared contents (duplicates)
+    std::uint64_t content_key(const std::uint64_t key) const
+    {
+      if (unit(key ^ 0x6475'70) < m_config.duplicates)
+        return mix(m_config.seed ^ (mix(key) % 16));
+      return key;
+    }
+
+    std::uint64_t size(const std::uint64_t content) const
+    {
+      return m_config.size / 2 + (m_config.size > 0 ? mix(content ^ 0x73'697a'65) % (m_config.size + 1) : 0);
+    }
+
+    // bytes of a content at an offset: one random 64-bit word per 8 bytes
+    void generate(const std::uint64_t content, const std::uint64_t offset, char* data, const std::size_t size) const
+    {
+      if (m_config.zero)
+      {
+        std::memset(data, 0, size);
+        return;
+      }
+      for (std::size_t i = 0; i < size;)
+      {
+        const std::uint64_t pos = offset + i;
+        const std::uint64_t word = mix(content + pos / 8);
+        const std::size_t skip = static_cast<std::size_t>(pos % 8);
+        const std::size_t n = std::min<std::size_t>(8 - skip, size - i);
+        std::memcpy(data + i, reinterpret_cast<const char*>(&word) + skip, n);
+        i += n;
+      }
+    }
+
+    // latency and error of one operation: the same operation always behaves the same way
+    void operation(const std::filesystem::path& path, const std::uint64_t key, const op o, const std::uint64_t offset)
+    {
+      m_operations.fetch_add(1, std::memory_order_relaxed);
+      const std::uint64_t h = mix(key ^ mix(static_cast<std::uint64_t>(o) ^ (offset << 3)));
+      std::chrono::microseconds latency = o == op::list ? m_config.list_latency :
+                                          o == op::stat ? m_config.stat_latency :
+                                          o == op::open ? m_config.open_latency : m_config.read_latency;
+      if (m_config.jitter.count() > 0)
+        latency += std::chrono::microseconds(static_cast<std::int64_t>(mix(h) % (m_config.jitter.count() + 1)));
+      if (latency.count() > 0)
+        std::this_thread::sleep_for(latency);
+      if (m_config.errors > 0 && unit(h) < m_config.errors)
+      {
+        m_errors.fetch_add(1, std::memory_order_relaxed);
+        static const char* names[] = { "", "list", "stat", "open", "read" };
+        throw std::runtime_error(fmt::format("simulated error: can't {} \"{}\" (offset {})",
+          names[static_cast<std::uint64_t>(o)], path.u8string(), offset));
+      }
+    }
+
+    const config m_config;
+    const std::size_t m_prefix;
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::pair<std::uint64_t, std::uint64_t>> m_times;
+    std::atomic<std::uint64_t> m_operations{ 0 };
+    std::atomic<std::uint64_t> m_read_bytes{ 0 };
+    std::atomic<std::uint64_t> m_errors{ 0 };
+  };
+}
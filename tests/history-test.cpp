@@ -0,0 +1,115 @@
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <stdexcept>
+#include <fmt/core.h>
+#include "history.hpp"
+
+// round-trip of the history: front-coded names, zigzag deltas of the timestamps, raw and
+// binary hashes, removed files and interrupted appends
+// - exit code: 0 if all the checks pass, 1 otherwise
+
+/*============================================
+| Function definitions
+==============================================*/
+void check(const bool condition, const std::string& what)
+{
+  if (!condition)
+    throw std::runtime_error(fmt::format("check failed: {}", what));
+}
+
+// sha of a file: binary digest (hexadecimal) or raw string (not a sha256)
+std::string fixture_sha(const std::size_t i, const std::size_t run)
+{
+  if (i % 7 == 0)
+    return fmt::format("raw-hash-{}-{}", i, run);
+  return fmt::format("{:064x}", (i + 1) * 0x9E3779B97F4A7C15ull + run);
+}
+
+// state of a run: files added, removed and modified from one run to the other
+history::state fixture_state(const std::size_t run)
+{
+  history::state files;
+  for (std::size_t i = 0; i < 200; ++i)
+  {
+    if ((i + run) % 11 == 0)
+      continue;
+    const std::size_t version = i % 5 == 0 ? run : 0;
+    // timestamps going back and forth: negative deltas
+    const std::uint64_t time = 1600000000 + (i % 2 ? i * 1000 : 0) - version;
+    files[fmt::format("c:\\data\\dir{:02}\\file{:04}.bin", i / 20, i)] = { fixture_sha(i, version), time, time + i, 4096 * i + version };
+  }
+  return files;
+}
+
+bool same_state(const history::state& a, const history::state& b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (auto i = a.cbegin(), j = b.cbegin(); i != a.cend(); ++i, ++j)
+    if (i->first != j->first ||
+        i->second.sha != j->second.sha ||
+        i->second.ctime != j->second.ctime ||
+        i->second.mtime != j->second.mtime ||
+        i->second.size != j->second.size)
+      return false;
+  return true;
+}
+
+int main()
+{
+  const std::filesystem::path& path = std::filesystem::temp_directory_path() / "mark-files-history-test.hist";
+  try
+  {
+    std::filesystem::remove(path);
+
+    // each run is restored as it was appended (bases and deltas)
+    constexpr std::size_t nb_runs = 12;
+    for (std::size_t run = 1; run <= nb_runs; ++run)
+      check(history::append(path, fixture_state(run)) == run, fmt::format("number of run {}", run));
+    const std::vector<history::run_info>& runs = history::list(path);
+    check(runs.size() == nb_runs, "number of runs");
+    check(runs.front().kind == history::base, "first run is a base");
+    for (std::size_t run = 1; run <= nb_runs; ++run)
+      check(same_state(history::load(path, run), fixture_state(run)), fmt::format("state of run {}", run));
+    check(same_state(history::load(path), fixture_state(nb_runs)), "state of the last run");
+
+    // interrupted append: the incomplete block is ignored, then overwritten
+    const std::uint64_t complete = std::filesystem::file_size(path);
+    {
+      std::ofstream file(path, std::ios::binary | std::ios::app);
+      const std::uint64_t size = 1000;
+      file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      file.write("\x01\x0d", 2);
+    }
+    check(history::list(path).size() == nb_runs, "incomplete block ignored");
+    check(history::append(path, fixture_state(nb_runs + 1)) == nb_runs + 1, "append after an incomplete block");
+    check(std::filesystem::file_size(path) > complete, "incomplete block truncated");
+    check(same_state(history::load(path), fixture_state(nb_runs + 1)), "state after an incomplete block");
+    check(same_state(history::load(path, nb_runs), fixture_state(nb_runs)), "previous state after an incomplete block");
+
+    // interrupted first append: only a part of the magic
+    std::filesystem::remove(path);
+    {
+      std::ofstream file(path, std::ios::binary);
+      file.write(history::magic, 3);
+    }
+    check(history::list(path).empty(), "incomplete magic ignored");
+    check(history::append(path, fixture_state(1)) == 1, "append after an incomplete magic");
+    check(same_state(history::load(path), fixture_state(1)), "state after an incomplete magic");
+
+    std::filesystem::remove(path);
+    fmt::print("history: all checks passed\n");
+    return 0;
+  }
+  catch (const std::exception& ex)
+  {
+    fmt::print("history: {}\n", ex.what());
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    return 1;
+  }
+}